@@ -7,7 +7,9 @@
 #include <stdio.h>
 #include "dbg.h"
 #include "ether.h"
+#include "fixq.h"
 #include "mblock.h"
+#include "mpscq.h"
 #include "net.h"
 #include "net_err.h"
 #include "netif.h"
@@ -17,6 +19,8 @@
 #include "pcap/pcap.h"
 #include "pktbuf.h"
 #include "sys_plat.h"
+#include "timer.h"
+#include "tools.h"
 
 
 pcap_data_t netdev0_data = {.ip = netdev0_phy_ip, .hwaddr = netdev0_hwaddr};
@@ -59,9 +63,285 @@ void mblock_test() {
 		mblock_free(&blist, temp[i]);
 		plat_printf("after free, free_count: %d\n", mblock_free_cnt(&blist));
 	}
+
+    // 批量分配与释放
+    int cnt = mblock_alloc_bulk(&blist, temp, 10);
+    plat_printf("bulk alloc: %d, free_count: %d\n", cnt, mblock_free_cnt(&blist));
+    mblock_free_bulk(&blist, temp, cnt);
+    plat_printf("after bulk free, free_count: %d\n", mblock_free_cnt(&blist));
 	mblock_destroy(&blist);
 }
 
+#define LF_TEST_BLK_CNT     64
+#define LF_TEST_THREADS     4
+#define LF_TEST_LOOPS       20000
+
+static mblock_t lf_list;
+static int lf_done;
+static int lf_errors;
+
+/**
+ * @brief 无锁存储块的并发分配/释放线程
+ *        分配到的块中写入本线程的标记，释放前检查，同一块被两个线程同时持有时标记会被改写
+ */
+static void mblock_lf_thread(void *arg) {
+    int tag = (int)(intptr_t)arg;
+    void *blks[8];
+
+    for (int i = 0; i < LF_TEST_LOOPS; i++) {
+        int cnt = mblock_alloc_bulk(&lf_list, blks, 7);
+        blks[cnt] = mblock_alloc(&lf_list, 0);
+        if (blks[cnt] == (void *)0) {
+            sys_atomic_inc(&lf_errors);
+            break;
+        }
+        cnt++;
+
+        for (int k = 0; k < cnt; k++) {
+            ((int *)blks[k])[1] = tag;
+        }
+        for (int k = 0; k < cnt; k++) {
+            if (((int *)blks[k])[1] != tag) {
+                sys_atomic_inc(&lf_errors);
+            }
+        }
+
+        mblock_free(&lf_list, blks[--cnt]);
+        mblock_free_bulk(&lf_list, blks, cnt);
+    }
+    sys_atomic_inc(&lf_done);
+}
+
+/**
+ * @brief 无锁存储块测试：单线程的分配/释放，再由多个线程并发分配/释放
+ */
+void mblock_lf_test(void) {
+    static uint8_t buffer[LF_TEST_BLK_CNT][16];
+    void *temp[LF_TEST_BLK_CNT];
+
+    mblock_init(&lf_list, buffer, 16, LF_TEST_BLK_CNT, NLOCKER_LOCKFREE);
+    for (int i = 0; i < 10; i++) {
+        temp[i] = mblock_alloc(&lf_list, -1);
+    }
+    int cnt = mblock_alloc_bulk(&lf_list, temp + 10, LF_TEST_BLK_CNT);
+    if ((cnt != LF_TEST_BLK_CNT - 10) || (mblock_free_cnt(&lf_list) != 0) || mblock_alloc(&lf_list, -1)) {
+        printf("mblock lockfree alloc error.");
+        exit(-1);
+    }
+    mblock_free_bulk(&lf_list, temp + 10, cnt);
+    for (int i = 0; i < 10; i++) {
+        mblock_free(&lf_list, temp[i]);
+    }
+    if (mblock_free_cnt(&lf_list) != LF_TEST_BLK_CNT) {
+        printf("mblock lockfree free error.");
+        exit(-1);
+    }
+
+    // 每个线程最多同时持有8块，总数不超过块数，分配总能成功
+    for (int i = 0; i < LF_TEST_THREADS; i++) {
+        sys_thread_create(mblock_lf_thread, (void *)(intptr_t)(i + 1));
+    }
+    for (int i = 0; (i < 10000) && (sys_atomic_load(&lf_done) < LF_TEST_THREADS); i++) {
+        sys_sleep(1);
+    }
+
+    if ((sys_atomic_load(&lf_done) != LF_TEST_THREADS) || lf_errors || (mblock_free_cnt(&lf_list) != LF_TEST_BLK_CNT)) {
+        printf("mblock lockfree thread error: done %d, errors %d, free %d", lf_done, lf_errors, mblock_free_cnt(&lf_list));
+        exit(-1);
+    }
+    mblock_destroy(&lf_list);
+}
+
+#define MPSCQ_TEST_PRODUCERS    4
+#define MPSCQ_TEST_MSG_CNT      5000
+
+typedef struct _mpscq_test_msg_t {
+    mpscq_node_t node;
+    int producer;
+    int seq;
+}mpscq_test_msg_t;
+
+static mpscq_t test_mpscq;
+static mpscq_test_msg_t mpscq_msgs[MPSCQ_TEST_PRODUCERS][MPSCQ_TEST_MSG_CNT];
+
+/**
+ * @brief 生产者线程，按序号依次投递本线程的消息
+ */
+static void mpscq_producer(void *arg) {
+    mpscq_test_msg_t *msgs = mpscq_msgs[(int)(intptr_t)arg];
+
+    for (int i = 0; i < MPSCQ_TEST_MSG_CNT; i++) {
+        mpscq_send(&test_mpscq, &msgs[i].node);
+    }
+}
+
+/**
+ * @brief 多生产者单消费者队列测试：每条消息恰好收到一次，且同一生产者的消息保持顺序
+ */
+void mpscq_test(void) {
+    int next_seq[MPSCQ_TEST_PRODUCERS];
+
+    mpscq_init(&test_mpscq);
+    for (int i = 0; i < MPSCQ_TEST_PRODUCERS; i++) {
+        for (int j = 0; j < MPSCQ_TEST_MSG_CNT; j++) {
+            mpscq_msgs[i][j].producer = i;
+            mpscq_msgs[i][j].seq = j;
+        }
+        next_seq[i] = 0;
+        sys_thread_create(mpscq_producer, (void *)(intptr_t)i);
+    }
+
+    for (int i = 0; i < MPSCQ_TEST_PRODUCERS * MPSCQ_TEST_MSG_CNT; i++) {
+        mpscq_node_t *node = mpscq_recv(&test_mpscq, 1000);
+        if (node == (mpscq_node_t *)0) {
+            printf("mpscq recv timeout: %d received.", i);
+            exit(-1);
+        }
+
+        mpscq_test_msg_t *msg = mpscq_entry(node, mpscq_test_msg_t, node);
+        if (msg->seq != next_seq[msg->producer]++) {
+            printf("mpscq order error: producer %d, seq %d.", msg->producer, msg->seq);
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < MPSCQ_TEST_PRODUCERS; i++) {
+        if (next_seq[i] != MPSCQ_TEST_MSG_CNT) {
+            printf("mpscq count error: producer %d.", i);
+            exit(-1);
+        }
+    }
+
+    // 队列已空，超时和不等待都应返回空
+    if (mpscq_recv(&test_mpscq, 10) || mpscq_recv(&test_mpscq, -1)) {
+        printf("mpscq empty recv error.");
+        exit(-1);
+    }
+    mpscq_destroy(&test_mpscq);
+}
+
+#define FIXQ_TEST_SIZE      8
+#define FIXQ_TEST_MSG_CNT   20000
+
+static fixq_t test_fixq;
+static int fixq_done;
+
+/**
+ * @brief 生产者线程，交替用单个发送和批量发送写入序号1..FIXQ_TEST_MSG_CNT
+ */
+static void fixq_producer(void *arg) {
+    void *msgs[5];
+    int seq = 1;
+
+    while (seq <= FIXQ_TEST_MSG_CNT) {
+        if (seq & 1) {
+            if (fixq_send(&test_fixq, (void *)(intptr_t)seq, 0) < 0) {
+                printf("fixq send error.");
+                exit(-1);
+            }
+            seq++;
+            continue;
+        }
+
+        int cnt = FIXQ_TEST_MSG_CNT - seq + 1;
+        cnt = cnt < 5 ? cnt : 5;
+        for (int i = 0; i < cnt; i++) {
+            msgs[i] = (void *)(intptr_t)(seq + i);
+        }
+
+        // 队列中空闲单元不足时只写入一部分
+        int n = fixq_send_many(&test_fixq, msgs, cnt, 0);
+        if (n <= 0) {
+            printf("fixq send many error.");
+            exit(-1);
+        }
+        seq += n;
+    }
+    sys_atomic_inc(&fixq_done);
+}
+
+/**
+ * @brief 用小队列在两个线程间传递远多于队列大小的消息，检查顺序和数量，以及空/满时的超时处理
+ */
+static void fixq_test_one(int spsc) {
+    static void *buf[FIXQ_TEST_SIZE];
+    void *msgs[6];
+
+    if (spsc) {
+        fixq_init_spsc(&test_fixq, buf, FIXQ_TEST_SIZE);
+    } else {
+        fixq_init(&test_fixq, buf, FIXQ_TEST_SIZE, NLOCKER_THREAD);
+    }
+
+    // 队列空：不等待和超时都取不到消息
+    if (fixq_recv(&test_fixq, -1) || fixq_recv(&test_fixq, 10) || fixq_recv_many(&test_fixq, msgs, 6, 10)) {
+        printf("fixq empty recv error.");
+        exit(-1);
+    }
+
+    fixq_done = 0;
+    sys_thread_create(fixq_producer, (void *)0);
+
+    int seq = 1;
+    while (seq <= FIXQ_TEST_MSG_CNT) {
+        int cnt;
+        if (seq & 1) {
+            msgs[0] = fixq_recv(&test_fixq, 0);
+            cnt = 1;
+        } else {
+            cnt = fixq_recv_many(&test_fixq, msgs, 6, 0);
+        }
+
+        for (int i = 0; i < cnt; i++) {
+            if ((int)(intptr_t)msgs[i] != seq++) {
+                printf("fixq order error: expect %d, get %d.", seq - 1, (int)(intptr_t)msgs[i]);
+                exit(-1);
+            }
+        }
+    }
+
+    // 等生产者线程完全退出发送函数，再测试队列满的情况
+    for (int i = 0; (i < 1000) && !sys_atomic_load(&fixq_done); i++) {
+        sys_sleep(1);
+    }
+    if (!sys_atomic_load(&fixq_done) || (fixq_count(&test_fixq) != 0)) {
+        printf("fixq count error.");
+        exit(-1);
+    }
+
+    // 队列满：不等待和超时都写不进消息
+    for (int i = 0; i < FIXQ_TEST_SIZE; i++) {
+        fixq_send(&test_fixq, (void *)(intptr_t)(i + 1), -1);
+    }
+    msgs[0] = (void *)1;
+    if ((fixq_count(&test_fixq) != FIXQ_TEST_SIZE) || (fixq_send(&test_fixq, msgs[0], -1) != NET_ERR_FULL)
+            || (fixq_send(&test_fixq, msgs[0], 10) != NET_ERR_TMO) || (fixq_send_many(&test_fixq, msgs, 1, -1) != NET_ERR_FULL)) {
+        printf("fixq full send error.");
+        exit(-1);
+    }
+    for (int i = 0; i < FIXQ_TEST_SIZE; i++) {
+        if ((int)(intptr_t)fixq_recv(&test_fixq, -1) != i + 1) {
+            printf("fixq full recv error.");
+            exit(-1);
+        }
+    }
+    fixq_destroy(&test_fixq);
+}
+
+/**
+ * @brief 消息队列测试，分别测试单生产者单消费者的无锁队列和加锁队列
+ */
+void fixq_test(void) {
+    fixq_test_one(1);
+    fixq_test_one(0);
+}
+
+static int ext_released;
+static void ext_release(void *arg, uint8_t *data) {
+    if (arg == data) {
+        ext_released++;
+    }
+}
+
 void pktbuf_test() {
     pktbuf_t *buf = pktbuf_alloc(2000);
     pktbuf_free(buf);
@@ -177,6 +457,41 @@ void pktbuf_test() {
 		exit(-1);
 	}
 
+    // 跨块校验和，与连续内存中的计算结果比较，包括奇数的起始位置和长度
+    for (int offset = 0; offset < 4; offset++) {
+        uint16_t sum = pktbuf_checksum16(buf, offset, 333, 0x1234);
+        if (sum != checksum16(0, (uint8_t *)temp + offset, 333, 0x1234, 1)) {
+            printf("checksum error.");
+            exit(-1);
+        }
+    }
+
+    // 取连续数据：块内直接返回指针，跨块复制到scratch中
+    for (int offset = 0; offset < 200; offset += 7) {
+        uint8_t scratch[60];
+        uint8_t *hdr = pktbuf_peek(buf, offset, sizeof(scratch), scratch);
+        if (!hdr || (plat_memcmp(hdr, (uint8_t *)temp + offset, sizeof(scratch)) != 0)) {
+            printf("peek error.");
+            exit(-1);
+        }
+    }
+
+    // 导出iovec：各段依次拼接后与原数据相同
+    struct iovec iov[PKTBUF_IOV_MAX];
+    int iov_cnt = pktbuf_to_iovec(buf, iov, PKTBUF_IOV_MAX);
+    uint8_t *iov_data = (uint8_t *)temp;
+    for (int i = 0; i < iov_cnt; i++) {
+        if (plat_memcmp(iov[i].iov_base, iov_data, iov[i].iov_len) != 0) {
+            printf("iovec error.");
+            exit(-1);
+        }
+        iov_data += iov[i].iov_len;
+    }
+    if ((iov_cnt <= 0) || (iov_data - (uint8_t *)temp != pktbuf_total(buf))) {
+        printf("iovec error.");
+        exit(-1);
+    }
+
 	// 填充测试
 	pktbuf_seek(dest, 0);
 	pktbuf_fill(dest, 53, pktbuf_total(dest));
@@ -191,8 +506,134 @@ void pktbuf_test() {
 		}
 	}
 
+    // 克隆：共享数据块，各自添加包头，写入时复制
+    pktbuf_t *clone = pktbuf_clone(buf);
+    pktbuf_add_header(clone, 14, 1);
+    pktbuf_add_header(buf, 20, 1);
+    pktbuf_seek(clone, 14);
+    pktbuf_fill(clone, 0xAA, 100);
+    pktbuf_seek(buf, 20);
+    pktbuf_read(buf, (uint8_t *)read_temp, 100);
+    if (plat_memcmp(temp, read_temp, 100) != 0) {
+        printf("clone not equal.");
+        exit(-1);
+    }
+    pktbuf_free(clone);
+    pktbuf_remove_header(buf, 20);
+
 	pktbuf_free(dest);
 	pktbuf_free(buf);  // 可以进去调试，在退出函数前看下所有块是否全部释放完毕
+
+    // 外部数据包：数据不复制，释放时回调
+    static uint8_t ext_data[1514];
+    ext_released = 0;
+    buf = pktbuf_alloc_ext(ext_data, sizeof(ext_data), ext_release, ext_data);
+    pktbuf_write(buf, (uint8_t *)temp, pktbuf_total(buf));
+    if ((pktbuf_data(buf) != ext_data) || (plat_memcmp(ext_data, temp, sizeof(ext_data)) != 0)) {
+        printf("ext data error.");
+        exit(-1);
+    }
+    pktbuf_add_header(buf, 14, 1);
+    pktbuf_remove_header(buf, 14);
+    pktbuf_free(buf);
+    if (ext_released != 1) {
+        printf("ext release error.");
+        exit(-1);
+    }
+
+    // 批量分配外部数据包
+    static uint8_t ext_bulk[40][64];
+    pktbuf_t *bulk_bufs[40];
+    uint8_t *bulk_data[40];
+    int bulk_size[40];
+    for (int i = 0; i < 40; i++) {
+        bulk_data[i] = ext_bulk[i];
+        bulk_size[i] = i + 1;
+    }
+    ext_released = 0;
+    int bulk_cnt = pktbuf_alloc_ext_bulk(bulk_bufs, bulk_data, bulk_size, 40, ext_release, (void **)bulk_data);
+    for (int i = 0; i < bulk_cnt; i++) {
+        if ((pktbuf_data(bulk_bufs[i]) != ext_bulk[i]) || (pktbuf_total(bulk_bufs[i]) != i + 1)) {
+            printf("ext bulk error.");
+            exit(-1);
+        }
+        pktbuf_free(bulk_bufs[i]);
+    }
+    if ((bulk_cnt != 40) || (ext_released != 40)) {
+        printf("ext bulk release error.");
+        exit(-1);
+    }
+
+    // 预留头部空间：添加包头只移动指针，不增加数据块
+    buf = pktbuf_alloc_reserve(1500, PKTBUF_HEADROOM);
+    int blk_cnt = buf->blk_list.count;
+    pktbuf_add_header(buf, 20, 1);
+    pktbuf_add_header(buf, 20, 1);
+    pktbuf_add_header(buf, 14, 1);
+    if ((buf->blk_list.count != blk_cnt) || (pktbuf_total(buf) != 1554)) {
+        printf("headroom error.");
+        exit(-1);
+    }
+    pktbuf_free(buf);
+}
+
+static int timer_fired[3];
+static void timer_test_proc(net_timer_t *timer, void *arg) {
+    timer_fired[(int)(intptr_t)arg]++;
+    plat_printf("timer %s timeout\n", timer->name);
+}
+
+void timer_test(void) {
+    static net_timer_wheel_t wheel;
+    static net_timer_t t0, t1, t2;
+
+    // 在当前线程中驱动一个时间轮
+    net_timer_wheel_init(&wheel);
+    net_timer_wheel_bind(&wheel);
+    net_timer_add(&t0, "t0", timer_test_proc, (void *)0, 20, 0);
+    net_timer_add(&t1, "t1", timer_test_proc, (void *)1, 10, NET_TIMER_RELOAD);
+    net_timer_add(&t2, "t2", timer_test_proc, (void *)2, 5000, 0);
+    net_timer_remove(&t2);
+
+    net_time_t start;
+    sys_time_curr(&start);
+    int elapsed = 0;
+    while (elapsed < 55) {
+        int tmo = net_timer_first_tmo(&wheel);
+        sys_sleep(tmo > 0 ? tmo : 1);
+        net_timer_check_tmo(&wheel);
+        elapsed += sys_time_goes(&start);
+    }
+    net_timer_remove(&t1);
+
+    if ((timer_fired[0] != 1) || (timer_fired[1] < 4) || (timer_fired[2] != 0)) {
+        printf("timer error.");
+        exit(-1);
+    }
+
+    // 时间轮空闲一段时间后再添加定时器，不能按空闲前的时间计算到期时刻而立即到期
+    net_timer_check_tmo(&wheel);
+    sys_sleep(100);
+    timer_fired[0] = 0;
+    net_timer_add(&t0, "t0", timer_test_proc, (void *)0, 30, 0);
+    net_timer_check_tmo(&wheel);
+    if (timer_fired[0] != 0) {
+        printf("timer idle error.");
+        exit(-1);
+    }
+
+    sys_time_curr(&start);
+    elapsed = 0;
+    while (!timer_fired[0] && (elapsed < 1000)) {
+        sys_sleep(1);
+        net_timer_check_tmo(&wheel);
+        elapsed += sys_time_goes(&start);
+    }
+    if ((timer_fired[0] != 1) || (elapsed < 29)) {
+        printf("timer idle tmo error: %d ms", elapsed);
+        exit(-1);
+    }
+    net_timer_wheel_bind((net_timer_wheel_t *)0);
 }
 
 /**
@@ -200,7 +641,11 @@ void pktbuf_test() {
  */
 void basic_test(void) {
 	mblock_test();
+    mblock_lf_test();
+    mpscq_test();
+    fixq_test();
     pktbuf_test();
+    timer_test();
 }
 
 /**
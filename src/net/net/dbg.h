@@ -42,6 +42,12 @@ void dump_ip_buf(const char* msg, const uint8_t* ip);
     }   \
 }
 
+/**
+ * @brief 编译期断言，条件不成立时数组长度为负，编译报错
+ * 只能在文件作用域中使用，name用于生成不重名的类型名
+ */
+#define dbg_static_assert(expr, name)   typedef char dbg_static_assert_##name[(expr) ? 1 : -1]
+
 #define DBG_DISP_ENABLED(module)  (module >= DBG_LEVEL_INFO)
 
 #endif // _DBG_H_
\ No newline at end of file
@@ -4,32 +4,56 @@
 #include "net_err.h"
 #include "netif.h"
 #include "nlist.h"
+#include "mpscq.h"
 
 /**
  * @brief 网络接口消息
  */
 typedef struct _msg_netif_t {
     netif_t *netif;
+    int worker;                 // 有数据包到达的输入队列，即处理该消息的工作线程
 }msg_netif_t;
 
+struct _msg_func_t;
+typedef net_err_t (*exmsg_func_t)(struct _msg_func_t *msg);
+
+/**
+ * @brief 在工作线程中执行函数的消息
+ */
+typedef struct _msg_func_t {
+    sys_thread_t thread;        // 发送消息的线程
+    int worker;                 // 执行函数的工作线程
+    exmsg_func_t func;          // 要执行的函数
+    void *param;                // 函数参数
+    net_err_t err;              // 函数的返回值
+    sys_sem_t wait_sem;         // 执行完成后通知发送线程
+}msg_func_t;
+
 /**
  * @brief 传递给核心线程的消息
  */
 typedef struct _exmsg_t {
+    mpscq_node_t node;          // 消息队列结点
+
     // 消息类型
     enum {
         NET_EXMSG_NETIF_IN,     // 网络接口消息类型
+        NET_EXMSG_FUN,          // 函数调用
     }type;
 
     // 消息数据
         union {
         msg_netif_t netif;      // 网络接口消息
+        msg_func_t *func;       // 函数调用
     };
 }exmsg_t;
 
 net_err_t exmsg_init(void);
 net_err_t exmsg_start(void);
-net_err_t exmsg_netif_in(netif_t *netif);
+net_err_t exmsg_netif_in(netif_t *netif, int worker);
+net_err_t exmsg_func_exec(int worker, exmsg_func_t func, void *param);
+void exmsg_netif_detach(netif_t *netif);
+void exmsg_netif_attach(netif_t *netif);
 
 
 #endif // _EXMSG_H_
\ No newline at end of file
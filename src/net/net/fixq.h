@@ -12,20 +12,35 @@
 #include "sys.h"
 
 typedef struct _fixq_t {
+    // 只读字段，初始化后不再修改，可被生产者与消费者同时缓存
     int size;               // 消息队列空闲单元长度
-    int in, out;            // 写入/读取时的索引位置
-    int cnt;                // 消息队列的当前消息个数
-
+    int spsc;               // 是否为单生产者/单消费者无锁模式
     void **buf;             // 消息结构数组
-
-    nlocker_t locker;
     sys_sem_t recv_sem;     // 读信号量
     sys_sem_t send_sem;     // 写信号量
+
+    // 加锁模式下双方都要修改的字段：锁及受其保护的消息计数
+    SYS_CACHE_ALIGNED nlocker_t locker;
+    int cnt;                // 消息队列的当前消息个数
+
+    // 生产者缓存行，只由写入方修改
+    // 无锁模式下生产者只修改prod，信号量仅在对方因队列空/满而等待时才通知
+    SYS_CACHE_ALIGNED int in;                   // 加锁模式的写入索引
+    int prod;                                   // 写入位置计数，在[0, 2 * size)内循环
+    int prod_wait;                              // 生产者正在等待空闲单元
+
+    // 消费者缓存行，只由读取方修改
+    SYS_CACHE_ALIGNED int out;                  // 加锁模式的读取索引
+    int cons;                                   // 读取位置计数，在[0, 2 * size)内循环
+    int cons_wait;                              // 消费者正在等待消息
 }fixq_t;
 
 net_err_t fixq_init(fixq_t *q, void **buf, int size, nlocker_type_t type);
+net_err_t fixq_init_spsc(fixq_t *q, void **buf, int size);
 net_err_t fixq_send(fixq_t *q, void *msg, int tmo);
 void *fixq_recv(fixq_t *q, int tmo);
+int fixq_send_many(fixq_t *q, void **msgs, int cnt, int tmo);
+int fixq_recv_many(fixq_t *q, void **msgs, int cnt, int tmo);
 void fixq_destroy(fixq_t *q);
 int fixq_count(fixq_t *q);
 
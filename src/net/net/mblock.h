@@ -6,17 +6,36 @@
 #include "sys_plat.h"
 
 typedef struct _mblock_t {
-    nlist_t free_list;      // 空闲链表
+    // 只读字段，每次释放时mblock_owns()都会读取，与被频繁修改的空闲链表分开存放
     void *start;            // 空闲链表起始地址
-    nlocker_t locker;       // 锁，用于多线程
+    int blk_size;           // 存储块大小，用于块地址与序号的转换
+    int blk_cnt;            // 存储块数量
     sys_sem_t alloc_sem;    // 用于分配时的信号量
+
+    // 每次分配/释放都会修改的字段，独占缓存行
+    SYS_CACHE_ALIGNED nlocker_t locker;         // 锁，用于多线程
+    nlist_t free_list;      // 空闲链表
+
+    // NLOCKER_LOCKFREE：空闲块组成无锁栈，块的前4个字节存放下一个空闲块的序号
+    uint64_t lf_top;        // 栈顶，高32位为版本号，低32位为块序号+1，0表示栈空
+    int lf_waiters;         // 正在等待空闲块的线程数
 }mblock_t;
 
 net_err_t mblock_init(mblock_t *mblock, void *mem, int blk_size, int cnt, nlocker_type_t share_type);
 void *mblock_alloc(mblock_t *mblock, int ms);
+int mblock_alloc_bulk(mblock_t *mblock, void **blocks, int cnt);
 int mblock_free_cnt(mblock_t *mblock);
 
 void mblock_free(mblock_t *mblock, void *block);
+void mblock_free_bulk(mblock_t *mblock, void **blocks, int cnt);
 void mblock_destroy(mblock_t *mblock);
 
+/**
+ * @brief 判断存储块是否属于该存储块管理器
+ */
+static inline int mblock_owns(mblock_t *mblock, void *block) {
+    uint8_t *start = (uint8_t *)mblock->start;
+    return ((uint8_t *)block >= start) && ((uint8_t *)block < start + (size_t)mblock->blk_size * mblock->blk_cnt);
+}
+
 #endif // _MBLOCK_H_
\ No newline at end of file
@@ -0,0 +1,39 @@
+/**
+ * @file mpscq.h
+ * @brief 多生产者/单消费者无锁消息队列
+ *        用于多个线程向核心线程投递消息。队列为侵入式结构，消息中嵌入mpscq_node_t即可入队，
+ *        不需要额外的存储空间，也没有长度限制，消息数量由消息的分配器决定
+ */
+
+#ifndef _MPSCQ_H_
+#define _MPSCQ_H_
+
+#include "net_err.h"
+#include "nlist.h"
+#include "sys.h"
+
+// 队列结点，嵌入到消息结构中
+typedef struct _mpscq_node_t {
+    struct _mpscq_node_t *next;
+}mpscq_node_t;
+
+typedef struct _mpscq_t {
+    SYS_CACHE_ALIGNED mpscq_node_t *head;       // 最后入队的结点，生产者通过原子交换修改
+    SYS_CACHE_ALIGNED mpscq_node_t *tail;       // 下一个出队的结点，只由消费者修改
+    mpscq_node_t stub;                          // 哨兵结点，保证队列中始终至少有一个结点
+    int cons_wait;                              // 消费者正在等待消息
+    sys_sem_t recv_sem;                         // 消费者等待用的信号量
+}mpscq_t;
+
+/**
+ * @brief 由消息中的结点得到消息本身的地址，node会被求值两次，不能直接传入函数调用
+ */
+#define mpscq_entry(node, parent_type, node_name)   \
+        ((parent_type *)(node ? noffset_to_parent((node), parent_type, node_name) : 0))
+
+net_err_t mpscq_init(mpscq_t *q);
+void mpscq_destroy(mpscq_t *q);
+void mpscq_send(mpscq_t *q, mpscq_node_t *node);
+mpscq_node_t *mpscq_recv(mpscq_t *q, int tmo);
+
+#endif // _MPSCQ_H_
@@ -6,7 +6,9 @@
 #define _NET_H_
 
 #include "net_err.h"
+#include "pktbuf.h"
 
+void net_set_pktbuf_cfg(const pktbuf_cfg_t *cfg);
 net_err_t net_init(void);
 net_err_t net_start(void);
 
@@ -19,20 +19,61 @@
 #define DBG_NETIF           DBG_LEVEL_INFO          // 网络接口层
 #define DBG_ETHER           DBG_LEVEL_INFO          // 以太网模块
 #define DBG_TOOLS           DBG_LEVEL_INFO          // 工具集
+#define DBG_TIMER           DBG_LEVEL_INFO          // 定时器
 
 #define EXMSG_MSG_CNT       10                      // 消息缓冲区大小
-#define EXMSG_LOCKER        NLOCKER_THREAD          // 核心线程的锁类型
+#define EXMSG_LOCKER        NLOCKER_LOCKFREE        // 核心线程消息块的锁类型
+#define EXMSG_WORKER_CNT    2                       // 工作线程数量，接收的数据包按流哈希分配给各线程处理
+#define EXMSG_WORKER_CPU    -1                      // 第一个工作线程绑定的cpu，其余线程依次递增，为-1时不绑定
+#define EXMSG_NETIF_BUDGET  300                     // 工作线程每轮从所有接口中最多处理的数据包数量，用完后先处理消息和定时器
+#define EXMSG_BUSY_POLL     0                       // 工作线程忙轮询驱动和输入队列，不依赖消息通知，以占用cpu换取更低的延迟
+#define EXMSG_POLL_BUDGET   64                      // 忙轮询时每轮从每个接口最多处理的数据包数量
+#define EXMSG_POLL_IDLE_CNT 10000                   // 忙轮询连续空闲的轮数，超过后退回到阻塞等待
+#define EXMSG_POLL_SLEEP    1                       // 退回阻塞等待后，驱动无法通知数据到达（无poll_arm）时，轮询驱动的线程最多等待多长时间(ms)再检查驱动
+#define TIMER_NAME_SIZE         16                  // 定时器名称长度
+#define NET_TIMER_WHEEL_BITS    6                   // 时间轮每层槽数的位数，每层64个槽
+#define NET_TIMER_WHEEL_LEVELS  4                   // 时间轮层数，最长定时时间为2^(6*4)ms，约4.6小时，更长的到时重新分配
+
+#define NLOCKER_SPIN_CNT    100                     // 自旋锁/自适应锁每轮自旋的最大次数
 
 #define NET_ENDIAN_LITTLE   1                       // 系统是否为小端
+#define NET_CHECKSUM_SIMD   1                       // 校验和计算是否使用SSE2/AVX2加速（仅x86）
 
-#define PKTBUF_BLK_SIZE     128                     // 数据包中每一块的大小
-#define PKTBUF_BLK_CNT      100                     // 数据包中块的总数量
+#define PKTBUF_BLK_SIZE     128                     // 数据包中小块的大小
+#define PKTBUF_BLK_CNT      100                     // 数据包中小块的总数量
+#define PKTBUF_BLK_MID_SIZE 512                     // 数据包中中块的大小
+#define PKTBUF_BLK_MID_CNT  50                      // 数据包中中块的总数量
+#define PKTBUF_BLK_BIG_SIZE 2048                    // 数据包中大块的大小，须能容纳一个完整的以太网帧
+#define PKTBUF_BLK_BIG_CNT  20                      // 数据包中大块的总数量
+#define PKTBUF_EXT_CNT      100                     // 外部数据块（只有块头）的总数量
 #define PKTBUF_BUF_CNT      100                     // 数据包的总数量
+#define PKTBUF_GROW         1                       // 池用完时是否映射新的内存区扩充
+#define PKTBUF_ARENA_MAX    8                       // 每个池最多的内存区数量
+#define PKTBUF_MAG_SIZE     16                      // 每个线程缓存的空闲块/包数量，为0时不使用线程缓存
+#define PKTBUF_BULK_SIZE    32                      // 批量分配数据包时，每批从池中取出的块头数量
+#define PKTBUF_LOCKER       NLOCKER_LOCKFREE        // 数据包/数据块空闲池的锁类型
+#define PKTBUF_HEADROOM     64                      // 发送数据包预留的头部空间，须能容纳各层协议的包头
+#define PKTBUF_IOV_MAX      16                      // 数据包导出为iovec时的最大分段数
 
 #define NETIF_HWADDR_SIZE   10                      // 硬件地址长度，mac地址最少6个字节
 #define NETIF_NAME_SIZE     10                      // 网络接口名称大小
 #define NETIF_DEV_CNT       4                       // 网络接口的数量
 #define NETIF_INQ_SIZE      50                      // 网卡输入队列最大容量
 #define NETIF_OUTQ_SIZE     50                      // 网卡输出队列最大容量
+#define NETIF_INQ_SPSC      1                       // 驱动只有一个接收线程时，输入队列使用单生产者/单消费者无锁模式
+#define NETIF_INQ_LOCKER    NLOCKER_ADAPTIVE        // 输入队列不使用无锁模式时的锁类型
+#define NETIF_OUTQ_LOCKER   NLOCKER_ADAPTIVE        // 输出队列的锁类型
+#define NETIF_WEIGHT        64                      // 接口的缺省权重，即每轮最多处理的数据包数量
+#define NETIF_IN_BATCH      32                      // 核心线程每次从输入队列中取出的最大数据包数量
+
+#define PCAP_RX_FRAME_CNT   NETIF_INQ_SIZE          // pcap驱动接收帧缓存数量
+#define PCAP_RX_BUDGET      64                      // pcap驱动线程每轮最多接收的数据帧数量
+#define PCAP_RX_BATCH       32                      // pcap驱动每次pcap_dispatch最多接收的数据帧数量
+#define PCAP_SNAPLEN        65536                   // pcap每帧最多捕获的字节数，超过帧缓存的帧按复制方式接收
+#define PCAP_BUFFER_SIZE    0                       // pcap内核接收缓存的大小，为0时使用pcap的缺省值
+#define PCAP_TX_BUDGET      64                      // pcap驱动线程每轮最多发送的数据包数量
+#define PCAP_TX_BATCH       32                      // pcap驱动积累多少个数据帧后一次发送，输出队列空闲时不等待凑满
+#define PCAP_IDLE_SPIN      200                     // pcap驱动线程连续空闲多少轮后进入睡眠
+#define PCAP_WAIT_TMO       100                     // pcap驱动线程睡眠的最长时间(ms)，防止驱动事件丢失时一直睡眠
 
 #endif // _NET_CFG_H_
\ No newline at end of file
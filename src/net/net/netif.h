@@ -43,6 +43,10 @@ typedef struct _netif_ops_t {
     net_err_t (*open)(struct _netif_t *netif, void *data);
     void (*close)(struct _netif_t *netif);
     net_err_t (*xmit)(struct _netif_t *netif);
+    int (*poll)(struct _netif_t *netif, int budget);   // 忙轮询模式下接收最多budget个数据包，返回接收的数量
+    int (*poll_arm)(struct _netif_t *netif);           // 忙轮询退回阻塞等待前调用，有数据到达时通知0号工作线程，返回0表示无法通知
+
+    int rx_single;                          // 驱动保证只有一个线程写入输入队列，此时输入队列可使用无锁模式
 }netif_ops_t;
 
 struct _netif_t;
@@ -79,8 +83,11 @@ typedef struct _netif_t {
 
     nlist_node_t node;                      // 链接结点，用于多个链接网络接口
     
-    fixq_t in_q;                            // 数据包输入队列
-    void * in_q_buf[NETIF_INQ_SIZE];        // 输入缓冲空间
+    fixq_t in_q[EXMSG_WORKER_CNT];          // 数据包输入队列，每个工作线程一个
+    void * in_q_buf[EXMSG_WORKER_CNT][NETIF_INQ_SIZE];  // 输入缓冲空间
+    int rx_pending[EXMSG_WORKER_CNT];       // 已通知工作线程或已在其轮询列表中，输入队列中的数据包一定会被处理
+    nlist_node_t poll_node[EXMSG_WORKER_CNT];   // 工作线程轮询列表中的结点
+    int weight;                             // 权重，每轮最多处理的数据包数量
     fixq_t out_q;                           // 数据包发送队列
     void * out_q_buf[NETIF_OUTQ_SIZE];      // 输出缓冲空间
 
@@ -95,12 +102,18 @@ net_err_t netif_set_deactive(netif_t *netif);
 net_err_t netif_close(netif_t *netif);
 net_err_t netif_register_layer(int type, const link_layer_t* layer);
 void netif_set_default(netif_t *netif);
+net_err_t netif_set_weight(netif_t *netif, int weight);
+netif_t *netif_first(void);
+netif_t *netif_next(netif_t *netif);
 
 // 数据包输入输出管理
 net_err_t netif_put_in(netif_t* netif, pktbuf_t* buf, int tmo);
+int netif_put_in_batch(netif_t *netif, pktbuf_t **bufs, int cnt);
 net_err_t netif_put_out(netif_t * netif, pktbuf_t * buf, int tmo);
-pktbuf_t* netif_get_in(netif_t* netif, int tmo);
+pktbuf_t* netif_get_in(netif_t* netif, int worker, int tmo);
+int netif_get_in_batch(netif_t *netif, int worker, pktbuf_t **bufs, int cnt, int tmo);
 pktbuf_t* netif_get_out(netif_t * netif, int tmo);
+int netif_get_out_batch(netif_t *netif, pktbuf_t **bufs, int cnt, int tmo);
 net_err_t netif_out(netif_t* netif, ipaddr_t* ipaddr, pktbuf_t* buf);
 
 
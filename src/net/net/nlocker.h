@@ -7,6 +7,9 @@
 typedef enum _nlocker_type_t {
     NLOCKER_NONE,
     NLOCKER_THREAD,
+    NLOCKER_LOCKFREE,               // 无锁，只用于mblock：空闲块由原子操作维护，加锁/解锁为空操作
+    NLOCKER_SPIN,                   // 自旋锁，适合很短的临界区，自旋一定次数后让出cpu
+    NLOCKER_ADAPTIVE,               // 自适应锁，先自旋一定次数，仍未获得时在信号量上睡眠
 }nlocker_type_t;
 
 typedef struct _nlocker_t {
@@ -15,6 +18,13 @@ typedef struct _nlocker_t {
     union 
     {
         sys_mutex_t mutex;
+
+        // NLOCKER_SPIN/NLOCKER_ADAPTIVE
+        struct {
+            int locked;             // 是否已被占用
+            int waiters;            // 在信号量上睡眠的线程数，只用于NLOCKER_ADAPTIVE
+            sys_sem_t sem;          // 睡眠用的信号量，只用于NLOCKER_ADAPTIVE
+        }spin;
     };
     
 }nlocker_t;
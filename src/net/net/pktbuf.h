@@ -8,27 +8,61 @@
 #include "net_err.h"
 #include "nlist.h"
 #include "net_cfg.h"
+#include "sys_plat.h"
 #include <stdint.h>
 
+/**
+ * @brief 外部数据的释放回调
+ *        外部数据块不拥有数据区，当数据块被释放时，通过该回调将数据区归还给其所有者（如驱动）
+ */
+typedef void (*pktblk_release_t)(void *arg, uint8_t *data);
+
+struct iovec;
+
+/**
+ * @brief 数据包池的配置，各项为每个内存区中对象的数量
+ */
+typedef struct _pktbuf_cfg_t {
+    int ext_cnt;                        // 外部数据块（只有块头）数量
+    int blk_cnt;                        // 小块数量
+    int mid_cnt;                        // 中块数量
+    int big_cnt;                        // 大块数量
+    int buf_cnt;                        // 数据包数量
+    int grow;                           // 池用完时是否映射新的内存区扩充
+}pktbuf_cfg_t;
+
 // 数据块
+// 块头位于块的起始处，每次读写都会访问的字段放在最前面，保证落在块头的第一个缓存行内
 typedef struct _pktblk_t {
     nlist_node_t node;                  // 指向下一个数据块
-    int size;                           // 数据块大小
     uint8_t *data;                      // 当前读写位置
-    uint8_t payload[PKTBUF_BLK_SIZE];   // 数据缓冲区
+    int size;                           // 数据块大小
+    int capacity;                       // 数据区容量
+    uint8_t *base;                      // 数据区起始地址，普通块指向payload，外部块指向外部内存
+
+    // 数据区共享：克隆出的块只有块头，数据区引用所有者块的数据区
+    int ref;                            // 引用本块数据区的块头数量，包括自身
+    int pool;                           // 所属的块池
+    struct _pktblk_t *owner;            // 数据区的所有者块，自身拥有数据区时为0
+
+    pktblk_release_t release;           // 外部数据释放回调，普通块为0
+    void *release_arg;                  // 释放回调的参数
+
+    uint8_t payload[];                  // 数据缓冲区，大小由所属的块池决定
 }pktblk_t;
 
 // 数据包
+// 数据块链等很少修改的字段与逐次读写都会修改的访问位置分别位于不同的缓存行
 typedef struct _pktbuf_t {
-    int total_size;         // 所有数据块中的总数据大小
-    nlist_t blk_list;       // 数据块链
-    nlist_node_t node;      // 指向下一个数据包
+    SYS_CACHE_ALIGNED nlist_t blk_list; // 数据块链
+    int total_size;                     // 所有数据块中的总数据大小
+    int ref;                            // 引用计数
+    nlist_node_t node;                  // 指向下一个数据包
 
     // 读写相关
-    int ref;                // 引用计数
-    int pos;                // 当前位置总的偏移量
-    pktblk_t *curr_blk;     // 当前指向的数据块
-    uint8_t *blk_offset;    // 在当前数据块中的偏移量
+    SYS_CACHE_ALIGNED int pos;          // 当前位置总的偏移量
+    pktblk_t *curr_blk;                 // 当前指向的数据块
+    uint8_t *blk_offset;                // 在当前数据块中的偏移量
 }pktbuf_t;
 
 /**
@@ -77,14 +111,21 @@ static inline uint8_t * pktbuf_data (pktbuf_t * buf) {
     return first ? first->data : (uint8_t *)0;
 }
 
-net_err_t pktbuf_init(void);
+net_err_t pktbuf_init(const pktbuf_cfg_t *cfg);
+void pktbuf_thread_exit(void);
 pktbuf_t *pktbuf_alloc(int size);
+pktbuf_t *pktbuf_alloc_reserve(int size, int headroom);
+pktbuf_t *pktbuf_alloc_ext(uint8_t *data, int size, pktblk_release_t release, void *arg);
+int pktbuf_alloc_ext_bulk(pktbuf_t **bufs, uint8_t **data, const int *size, int cnt,
+                          pktblk_release_t release, void **arg);
+pktbuf_t *pktbuf_clone(pktbuf_t *buf);
 void pktbuf_free(pktbuf_t *buf);
 
 net_err_t pktbuf_add_header(pktbuf_t *buf, int size, int cont);
 net_err_t pktbuf_remove_header(pktbuf_t *buf, int size);
 net_err_t pktbuf_resize(pktbuf_t *buf, int to_size);
 net_err_t pktbuf_join(pktbuf_t *dst, pktbuf_t *src);
+net_err_t pktbuf_set_cont(pktbuf_t *buf, int size);
 
 void pktbuf_reset_acc(pktbuf_t* buf);
 net_err_t pktbuf_write(pktbuf_t *buf, uint8_t *src, int size);
@@ -93,5 +134,8 @@ net_err_t pktbuf_seek(pktbuf_t *buf, int offset);
 net_err_t pktbuf_copy(pktbuf_t *dest, pktbuf_t *src, int size);
 net_err_t pktbuf_fill(pktbuf_t *buf, uint8_t v, int size);
 void pktbuf_inc_ref (pktbuf_t *buf);
+uint16_t pktbuf_checksum16(pktbuf_t *buf, int offset, int len, uint32_t seed);
+uint8_t *pktbuf_peek(pktbuf_t *buf, int offset, int len, uint8_t *scratch);
+int pktbuf_to_iovec(pktbuf_t *buf, struct iovec *iov, int iov_cnt);
 
 #endif // _PKTBUF_H_
\ No newline at end of file
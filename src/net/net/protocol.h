@@ -0,0 +1,20 @@
+/**
+ * @file protocol.h
+ * @brief 协议类型编号
+ */
+
+#ifndef _PROTOCOL_H_
+#define _PROTOCOL_H_
+
+/**
+ * @brief 常用协议类型：以太网帧中的上层协议类型及IP包中的上层协议号
+ */
+typedef enum _protocol_t {
+    NET_PROTOCOL_ARP = 0x0806,              // ARP协议
+    NET_PROTOCOL_IPv4 = 0x0800,             // IPv4协议
+    NET_PROTOCOL_ICMPv4 = 0x1,              // ICMP协议
+    NET_PROTOCOL_UDP = 0x11,                // UDP协议
+    NET_PROTOCOL_TCP = 0x06,                // TCP协议
+}protocol_t;
+
+#endif // _PROTOCOL_H_
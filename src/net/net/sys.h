@@ -11,6 +11,8 @@ sys_sem_t sys_sem_create(int init_count);
 void sys_sem_free(sys_sem_t sem);
 int sys_sem_wait(sys_sem_t sem, uint32_t ms);
 void sys_sem_notify(sys_sem_t sem);
+int sys_sem_try_wait_n(sys_sem_t sem, int n);
+void sys_sem_notify_n(sys_sem_t sem, int n);
 
 // 互斥信号量：由具体平台实现
 sys_mutex_t sys_mutex_create(void);
@@ -24,6 +26,16 @@ typedef void (*sys_thread_func_t)(void * arg);
 sys_thread_t sys_thread_create(sys_thread_func_t entry, void* arg);
 void sys_thread_exit (int error);
 void sys_sleep(int ms);
+void sys_thread_yield(void);
+int sys_thread_bind_cpu(sys_thread_t thread, int cpu);
+
+// 时间相关：由具体平台实现
+void sys_time_curr (net_time_t * time);
+int sys_time_goes (net_time_t * pre);
+
+// 内存映射：用于数据包池等大块内存，由具体平台实现
+void *sys_mem_map(size_t *size);
+void sys_mem_unmap(void *mem, size_t size);
 sys_thread_t sys_thread_self (void);
 
 #endif // _SYS_H_
\ No newline at end of file
@@ -0,0 +1,64 @@
+/**
+ * @file timer.h
+ * @brief 协议栈定时器
+ *
+ * 定时器由工作线程拥有和驱动，使用分层时间轮组织：添加和删除都是O(1)的，
+ * 与定时器数量无关。工作线程等待消息时，以最近的定时器到期时间作为超时
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "net_cfg.h"
+#include "net_err.h"
+#include "nlist.h"
+#include "sys.h"
+
+#define NET_TIMER_RELOAD        (1 << 0)        // 周期性定时器，到期后自动重新开始
+
+#define NET_TIMER_SLOTS         (1 << NET_TIMER_WHEEL_BITS)    // 每层时间轮的槽数
+#define NET_TIMER_SLOT_MASK     (NET_TIMER_SLOTS - 1)
+
+struct _net_timer_t;
+typedef void (*timer_proc_t)(struct _net_timer_t *timer, void *arg);
+
+/**
+ * @brief 定时器
+ */
+typedef struct _net_timer_t {
+    char name[TIMER_NAME_SIZE];             // 定时器名称，用于调试
+    int flags;                              // 是否周期性等标志
+
+    uint32_t expire;                        // 到期时刻，以时间轮的毫秒计数表示
+    int reload;                             // 周期性定时器的周期(ms)
+
+    timer_proc_t proc;                      // 到期回调
+    void *arg;                              // 回调参数
+
+    nlist_node_t node;                      // 所在槽的链表结点
+    nlist_t *slot;                          // 所在的槽，为0表示未运行
+    int level;                              // 所在的时间轮层次
+    struct _net_timer_wheel_t *wheel;       // 所属的时间轮
+}net_timer_t;
+
+/**
+ * @brief 分层时间轮
+ *        第0层每个槽对应1ms，第n层每个槽对应第n-1层转一圈的时间。定时器按剩余时间放入合适的层，
+ *        低一层转完一圈时，将高一层对应槽中的定时器重新分配到低层，最终在第0层到期
+ */
+typedef struct _net_timer_wheel_t {
+    uint32_t jiffies;                       // 时间轮启动以来经过的毫秒数
+    uint32_t now;                           // 下一个待处理的毫秒，早于它到期的定时器都已处理
+    net_time_t last;                        // 上次更新jiffies的系统时间
+    int cnt[NET_TIMER_WHEEL_LEVELS];        // 每层中的定时器数量
+    nlist_t slots[NET_TIMER_WHEEL_LEVELS][NET_TIMER_SLOTS];
+}net_timer_wheel_t;
+
+void net_timer_wheel_init(net_timer_wheel_t *wheel);
+void net_timer_wheel_bind(net_timer_wheel_t *wheel);
+net_err_t net_timer_add(net_timer_t *timer, const char *name, timer_proc_t proc, void *arg, int ms, int flags);
+void net_timer_remove(net_timer_t *timer);
+int net_timer_check_tmo(net_timer_wheel_t *wheel);
+int net_timer_first_tmo(net_timer_wheel_t *wheel);
+
+#endif // _TIMER_H_
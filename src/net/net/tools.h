@@ -48,6 +48,31 @@ uint32_t swap_u32(uint32_t v);
 #define x_ntohl(v)        (v)
 #endif
 
+/**
+ * @brief 增量更新校验和（RFC 1624）
+ *        修改包头中的某个16位字段后，无需重新计算整个校验和
+ *
+ * @param checksum 包头中原来的校验和
+ * @param old_v 字段原来的值，与包中的字节顺序一致
+ * @param new_v 字段新的值，与包中的字节顺序一致
+ * @return 新的校验和
+ */
+static inline uint16_t checksum16_update(uint16_t checksum, uint16_t old_v, uint16_t new_v) {
+    uint32_t sum = (uint16_t)~checksum + (uint16_t)~old_v + (uint32_t)new_v;
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief 增量更新校验和，用于修改32位字段，如IP地址
+ */
+static inline uint16_t checksum16_update32(uint16_t checksum, uint32_t old_v, uint32_t new_v) {
+    checksum = checksum16_update(checksum, (uint16_t)(old_v >> 16), (uint16_t)(new_v >> 16));
+    return checksum16_update(checksum, (uint16_t)old_v, (uint16_t)new_v);
+}
+
 net_err_t tools_init(void);
+uint16_t checksum16(uint32_t offset, const void *buf, int len, uint32_t pre_sum, int complement);
 
 #endif // TOOLS_H
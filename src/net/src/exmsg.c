@@ -1,20 +1,38 @@
 /**
  * @brief TCP/IP核心线程通信模块。
- *        此处运行了一个核心线程，所有TCP/IP中相关的事件都交由该线程处理
+ *        此处运行了EXMSG_WORKER_CNT个工作线程，所有TCP/IP中相关的事件都交由这些线程处理。
+ *        每个工作线程有自己的消息队列，并处理各网络接口中属于自己的输入队列，
+ *        接收的数据包按流哈希分配（见netif_put_in），同一条流总是由同一个线程处理
  */
 
 #include "exmsg.h"
 #include "dbg.h"
-#include "fixq.h"
 #include "ipaddr.h"
 #include "mblock.h"
+#include "mpscq.h"
 #include "net_err.h"
 #include "netif.h"
+#include "nlocker.h"
 #include "pktbuf.h"
 #include "sys_plat.h"
+#include "timer.h"
 
-static void *msg_tbl[EXMSG_MSG_CNT];        // 消息缓冲区
-static fixq_t msg_queue;                    // 消息队列
+/**
+ * @brief 工作线程
+ */
+typedef struct _exmsg_worker_t {
+    mpscq_t msg_queue;                      // 消息队列，各线程无锁投递，工作线程读取
+    int id;                                 // 线程序号，同时也是各网络接口输入队列的序号
+    int polling;                            // 正在忙轮询，此时有数据包到达无需发送通知
+    net_timer_wheel_t timer_wheel;          // 本线程拥有的定时器
+    nlist_t poll_list;                      // 输入队列中有数据包待处理的接口，轮流处理
+    nlocker_t func_locker;                  // 同时只允许一个线程在该工作线程中执行函数
+    sys_sem_t func_sem;                     // 函数执行完成后通知调用者，一直保留不释放
+}exmsg_worker_t;
+
+static exmsg_worker_t workers[EXMSG_WORKER_CNT];
+static int workers_started;                             // 工作线程是否已启动
+static SYS_THREAD_LOCAL exmsg_worker_t *curr_worker;     // 当前线程所在的工作线程，非工作线程为0
 
 // 通过msg_block从msg_buffer中申请一个消息，写入后再发给msg_queue
 // msg_queue处理完毕后，再返回给msg_block
@@ -28,14 +46,32 @@ static mblock_t msg_block;                  // 消息块分配器
 net_err_t exmsg_init(void) {
     dbg_info(DBG_MSG, "exmsg init");
 
-    // 初始化消息队列
-    net_err_t err = fixq_init(&msg_queue, msg_tbl, EXMSG_MSG_CNT, EXMSG_LOCKER);
-    if (err < 0) {
-        dbg_error(DBG_MSG, "fixq init failed.");
-        return err;
+    // 初始化各工作线程的消息队列
+    net_err_t err;
+    for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+        workers[i].id = i;
+        net_timer_wheel_init(&workers[i].timer_wheel);
+        nlist_init(&workers[i].poll_list);
+        err = mpscq_init(&workers[i].msg_queue);
+        if (err < 0) {
+            dbg_error(DBG_MSG, "mpscq init failed.");
+            return err;
+        }
+
+        // 通知方在唤醒等待者后仍可能访问信号量，不能由调用者每次创建、释放
+        err = nlocker_init(&workers[i].func_locker, NLOCKER_THREAD);
+        if (err < 0) {
+            dbg_error(DBG_MSG, "func locker init failed.");
+            return err;
+        }
+        workers[i].func_sem = sys_sem_create(0);
+        if (workers[i].func_sem == SYS_SEM_INVALID) {
+            dbg_error(DBG_MSG, "create func sem failed.");
+            return NET_ERR_MEM;
+        }
     }
 
-    // 初始化消息块分配器
+    // 初始化消息块分配器，由所有工作线程共享
     err = mblock_init(&msg_block, msg_buffer, sizeof(exmsg_t), EXMSG_MSG_CNT, EXMSG_LOCKER);
     if (err < 0) {
         dbg_error(DBG_MSG, "mblock init failed.");
@@ -48,91 +84,438 @@ net_err_t exmsg_init(void) {
 }
 
 /**
- * @brief 接收网卡发来的数据包，并加入消息队列
+ * @brief 接收网卡发来的数据包，通知对应的工作线程处理
+ *        每个输入队列同时最多只有一个通知：从发出通知到接口离开线程的轮询列表之前，
+ *        再到达的数据包都会被一并处理，因此突发的大量数据包只需一个消息，消息块也不会被耗尽
+ * @param worker 数据包所在的输入队列序号
  */
-net_err_t exmsg_netif_in(netif_t *netif) {
+net_err_t exmsg_netif_in(netif_t *netif, int worker) {
+#if EXMSG_BUSY_POLL
+    // 工作线程正在忙轮询，会自行检查输入队列。屏障保证先入队再读取标志，与poll_thread中的检查配对
+    sys_atomic_fence();
+    if (sys_atomic_load(&workers[worker].polling)) {
+        return NET_ERR_OK;
+    }
+#endif
+
+    // 已有通知未处理，或接口已在轮询列表中。交换同时作为屏障，保证线程清除标志后能看到此前入队的数据包
+    if (sys_atomic_xchg(&netif->rx_pending[worker], 1)) {
+        return NET_ERR_OK;
+    }
+
     // 由于后续要用中断处理，因此此处不应该等，这样无可避免会出现数据包丢失，属于正常情况，不是协议栈需要去考虑的
     exmsg_t *msg = mblock_alloc(&msg_block, -1);  
     if (!msg) {
+        // 清除标志，由下一个到达的数据包再次通知
+        sys_atomic_store(&netif->rx_pending[worker], 0);
         dbg_warning(DBG_MSG, "no free exmsg");
         return NET_ERR_MEM;
     }
 
     msg->type = NET_EXMSG_NETIF_IN;
     msg->netif.netif = netif;
+    msg->netif.worker = worker;
 
-    net_err_t err = fixq_send(&msg_queue, msg, -1);
-    if (err < 0) {
-        dbg_warning(DBG_MSG, "fixq full");
-        mblock_free(&msg_block, msg);
-        return err;
+    // 消息数量由msg_block限制，入队总是成功
+    mpscq_send(&workers[worker].msg_queue, &msg->node);
+    return NET_ERR_OK;
+}
+
+/**
+ * @brief 在指定的工作线程中执行函数，并等待其执行完成
+ *        用于访问只能由某个工作线程访问的数据，如输入队列和轮询列表。
+ *        工作线程尚未启动，或调用者就是该工作线程时，直接执行。
+ *        不要在一个工作线程中等待另一个工作线程，否则两者互相等待时会死锁
+ * @return 函数的返回值
+ */
+net_err_t exmsg_func_exec(int worker, exmsg_func_t func, void *param) {
+    msg_func_t func_msg;
+    func_msg.thread = sys_thread_self();
+    func_msg.worker = worker;
+    func_msg.func = func;
+    func_msg.param = param;
+    func_msg.err = NET_ERR_OK;
+
+    if (!sys_atomic_load(&workers_started) || (curr_worker == &workers[worker])) {
+        return func(&func_msg);
     }
 
-    return NET_ERR_OK;
+    // 调用者本身不是工作线程，可以等待空闲的消息块
+    exmsg_t *msg = (exmsg_t *)mblock_alloc(&msg_block, 0);
+    if (!msg) {
+        dbg_error(DBG_MSG, "no free exmsg");
+        return NET_ERR_MEM;
+    }
+    msg->type = NET_EXMSG_FUN;
+    msg->func = &func_msg;
+
+    // 各调用者共用该工作线程的信号量，逐个执行
+    nlocker_lock(&workers[worker].func_locker);
+    func_msg.wait_sem = workers[worker].func_sem;
+
+    dbg_info(DBG_MSG, "begin call func: %p", func);
+    mpscq_send(&workers[worker].msg_queue, &msg->node);
+
+    // 等待执行完成
+    sys_sem_wait(func_msg.wait_sem, 0);
+    dbg_info(DBG_MSG, "end call func: %p", func);
+
+    nlocker_unlock(&workers[worker].func_locker);
+    return func_msg.err;
+}
+
+/**
+ * @brief 处理网络接口中属于本线程的输入队列中的数据包，最多处理budget个
+ * @return 处理的数据包数量
+ */
+static int netif_in_process(netif_t *netif, int worker, int budget) {
+    pktbuf_t *bufs[NETIF_IN_BATCH];
+    int total = 0;
+
+    // 每次从输入队列中批量取出一组数据包
+    while (total < budget) {
+        int cnt = (budget - total) > NETIF_IN_BATCH ? NETIF_IN_BATCH : (budget - total);
+        cnt = netif_get_in_batch(netif, worker, bufs, cnt, -1);
+        if (cnt <= 0) {
+            break;
+        }
+
+        for (int i = 0; i < cnt; i++) {
+            pktbuf_t *buf = bufs[i];
+            dbg_info(DBG_MSG, "recv a packet, size: %d", pktbuf_total(buf));
+
+            // pktbuf_fill(buf, 0x11, 6);
+            // net_err_t err = netif_out(netif, (ipaddr_t *)0, buf);
+            // /**
+            //  * 在netif_out中包含两步：1）将数据包加入就绪队列（输出队列）中；2）启动发送过程。
+            //  * 如果数据包已经加入就绪队列中，那么此时若出错，不应该对这个数据包进行释放。只有当
+            //  * 数据包还未加入就绪队列时出错，才应该进行释放工作。
+            //  * 
+            //  * 当err<0时，说明数据包还未交给上层协议栈进行处理，因此在此处进行buf的释放工作；
+            //  * 否则，说明数据包已经到达上层协议栈，因此由上层协议栈内部自行负责释放工作。
+            //  */
+            // if (err < 0) {
+            //     pktbuf_free(buf);
+            // }
+
+        
+        }
+        total += cnt;
+    }
+
+    return total;
+}
+
+/**
+ * @brief 接口是否已在线程的轮询列表中。移出列表的结点前后均为空
+ */
+static int poll_list_has(exmsg_worker_t *worker, netif_t *netif) {
+    nlist_node_t *node = &netif->poll_node[worker->id];
+    return node->pre || node->next || (nlist_first(&worker->poll_list) == node);
 }
 
 /**
  * @brief 网络接口有数据到达时的相关处理
+ *        将接口加入线程的轮询列表，由exmsg_poll_list按权重轮流处理
  */
 static net_err_t do_netif_in(exmsg_t *msg) {
     netif_t *netif = msg->netif.netif;
+    exmsg_worker_t *worker = &workers[msg->netif.worker];
 
-    pktbuf_t *buf;
-    while ((buf = netif_get_in(netif, -1))) {
-        dbg_info(DBG_MSG, "recv a packet");
-
-        // pktbuf_fill(buf, 0x11, 6);
-        // net_err_t err = netif_out(netif, (ipaddr_t *)0, buf);
-        // /**
-        //  * 在netif_out中包含两步：1）将数据包加入就绪队列（输出队列）中；2）启动发送过程。
-        //  * 如果数据包已经加入就绪队列中，那么此时若出错，不应该对这个数据包进行释放。只有当
-        //  * 数据包还未加入就绪队列时出错，才应该进行释放工作。
-        //  * 
-        //  * 当err<0时，说明数据包还未交给上层协议栈进行处理，因此在此处进行buf的释放工作；
-        //  * 否则，说明数据包已经到达上层协议栈，因此由上层协议栈内部自行负责释放工作。
-        //  */
-        // if (err < 0) {
-        //     pktbuf_free(buf);
-        // }
+    // 停用接口时可能有通知正在发送，重新激活后又收到新的通知，此时接口已在列表中
+    if (!poll_list_has(worker, netif)) {
+        nlist_insert_last(&worker->poll_list, &netif->poll_node[worker->id]);
+    }
+    return NET_ERR_OK;
+}
 
-        
+/**
+ * @brief 轮流处理轮询列表中各接口的输入队列
+ *        每个接口一次最多处理weight个数据包，处理满的接口移到列表尾部，等下一次轮到它；
+ *        队列已空的接口移出列表。所有接口合计最多处理EXMSG_NETIF_BUDGET个，
+ *        用完后返回，让线程先处理消息和定时器，避免一个繁忙的接口长时间占用线程
+ * @return 处理的数据包数量
+ */
+static int exmsg_poll_list(exmsg_worker_t *worker) {
+    int budget = EXMSG_NETIF_BUDGET;
+
+    while ((budget > 0) && !nlist_is_empty(&worker->poll_list)) {
+        nlist_node_t *node = nlist_remove_first(&worker->poll_list);
+        netif_t *netif = nlist_entry(node, netif_t, poll_node[worker->id]);
+
+        int quota = netif->weight < budget ? netif->weight : budget;
+        int cnt = netif_in_process(netif, worker->id, quota);
+        budget -= cnt;
+        if (cnt >= quota) {
+            // 用完了配额，队列中可能还有数据包，排到最后
+            nlist_insert_last(&worker->poll_list, node);
+            continue;
+        }
+
+        // 队列已空，清除标志后再检查一次：清除前入队的数据包，生产者不会再通知
+        sys_atomic_xchg(&netif->rx_pending[worker->id], 0);
+        if ((fixq_count(&netif->in_q[worker->id]) > 0) && !sys_atomic_xchg(&netif->rx_pending[worker->id], 1)) {
+            nlist_insert_last(&worker->poll_list, node);
+        }
+    }
+
+    return EXMSG_NETIF_BUDGET - budget;
+}
+
+/**
+ * @brief 将接口从当前工作线程中移除，在该工作线程中执行
+ *        移出轮询列表，释放输入队列中的数据包，并置位rx_pending使驱动不再发送通知。
+ *        此前发出的通知都已在本消息之前处理完毕
+ */
+static net_err_t netif_detach(msg_func_t *msg) {
+    netif_t *netif = (netif_t *)msg->param;
+    exmsg_worker_t *worker = &workers[msg->worker];
+
+    if (poll_list_has(worker, netif)) {
+        nlist_remove(&worker->poll_list, &netif->poll_node[worker->id]);
+    }
+    sys_atomic_store(&netif->rx_pending[worker->id], 1);
+
+    pktbuf_t *bufs[NETIF_IN_BATCH];
+    int cnt;
+    while ((cnt = netif_get_in_batch(netif, worker->id, bufs, NETIF_IN_BATCH, -1)) > 0) {
+        for (int i = 0; i < cnt; i++) {
+            pktbuf_free(bufs[i]);
+        }
+    }
+    return NET_ERR_OK;
+}
+
+/**
+ * @brief 将接口从所有工作线程中移除，返回后各线程不再访问该接口，接口结构可被释放。
+ *        调用前接口应已不再激活，驱动已不再写入输入队列，否则之后到达的数据包仍留在队列中
+ */
+void exmsg_netif_detach(netif_t *netif) {
+    for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+        exmsg_func_exec(i, netif_detach, netif);
+    }
+}
+
+/**
+ * @brief 接口重新激活后，恢复驱动的通知。停用期间留在输入队列中的数据包由此补发通知
+ */
+void exmsg_netif_attach(netif_t *netif) {
+    for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+        sys_atomic_store(&netif->rx_pending[i], 0);
+        if (fixq_count(&netif->in_q[i]) > 0) {
+            exmsg_netif_in(netif, i);
+        }
     }
 
+#if EXMSG_BUSY_POLL
+    // 0号线程可能已退回阻塞等待，此前没有让该接口的驱动通知，唤醒它重新设置
+    if (netif->ops->poll) {
+        exmsg_netif_in(netif, 0);
+    }
+#endif
+}
+
+/**
+ * @brief 执行工作线程函数调用消息，完成后通知调用者
+ */
+static net_err_t do_func(msg_func_t *func) {
+    dbg_info(DBG_MSG, "call func");
+
+    func->err = func->func(func);
+    sys_sem_notify(func->wait_sem);
+
+    dbg_info(DBG_MSG, "func exec complete");
     return NET_ERR_OK;
 }
 
 /**
- * @brief 核心线程功能
+ * @brief 处理一个消息，处理完毕后释放
+ */
+static void exmsg_handle(exmsg_t *msg) {
+    // 打印接收到消息的具体信息
+    dbg_info(DBG_MSG, "recieve a msg(%p): %d", msg, msg->type);
+    switch (msg->type) {
+    case NET_EXMSG_NETIF_IN:          // 网络接口消息
+        do_netif_in(msg);
+        break;
+    case NET_EXMSG_FUN:               // 函数调用
+        do_func(msg->func);
+        break;
+    }
+
+    // 释放消息
+    mblock_free(&msg_block, msg);
+}
+
+/**
+ * @brief 工作线程等待消息的超时，最多等到下一个定时器到期
+ * @param max_tmo 最长等待时间，0表示无限制
+ * @return mpscq_recv使用的超时：0一直等待，-1不等待
+ */
+static int exmsg_wait_tmo(exmsg_worker_t *worker, int max_tmo) {
+    int tmo = net_timer_first_tmo(&worker->timer_wheel);
+    if (tmo < 0) {
+        return max_tmo;
+    } else if (tmo == 0) {
+        return -1;
+    }
+
+    return ((max_tmo > 0) && (max_tmo < tmo)) ? max_tmo : tmo;
+}
+
+#if !EXMSG_BUSY_POLL
+/**
+ * @brief 工作线程功能
  */
 static void work_thread(void *arg) {
-    dbg_info(DBG_MSG, "exmsg is running...\n");
+    exmsg_worker_t *worker = (exmsg_worker_t *)arg;
+    dbg_info(DBG_MSG, "exmsg worker %d is running...\n", worker->id);
+
+    // 本线程中添加的定时器都由自己驱动
+    net_timer_wheel_bind(&worker->timer_wheel);
+    curr_worker = worker;
+    while (1) {
+        // 接收消息，有定时器时最多等到其到期。还有接口待处理时不等待
+        int tmo = nlist_is_empty(&worker->poll_list) ? exmsg_wait_tmo(worker, 0) : -1;
+        mpscq_node_t *node = mpscq_recv(&worker->msg_queue, tmo);
+        exmsg_t *msg = mpscq_entry(node, exmsg_t, node);
+        if (msg) {
+            exmsg_handle(msg);
+        }
+
+        // 执行到期的定时器
+        net_timer_check_tmo(&worker->timer_wheel);
+
+        // 处理一轮接口的输入队列
+        exmsg_poll_list(worker);
+    }
+}
+#else
+/**
+ * @brief 轮询一遍所有接口：处理各接口中属于本线程的输入队列，0号线程同时轮询驱动接收
+ *        驱动只由0号线程轮询，保证每个输入队列只有一个生产者
+ * @return 本轮接收及处理的数据包数量
+ */
+static int exmsg_poll(exmsg_worker_t *worker) {
+    int cnt = 0;
+
+    for (netif_t *netif = netif_first(); netif; netif = netif_next(netif)) {
+        if (sys_atomic_load(&netif->state) != NETIF_ACTIVE) {
+            continue;
+        }
+
+        if ((worker->id == 0) && netif->ops->poll) {
+            cnt += netif->ops->poll(netif, EXMSG_POLL_BUDGET);
+        }
+        cnt += netif_in_process(netif, worker->id, EXMSG_POLL_BUDGET);
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief 0号线程退回阻塞等待前，让各接口的驱动在有数据到达时通知它
+ * @return 等待消息的最长时间：有驱动无法通知时为EXMSG_POLL_SLEEP，只能定时轮询；否则为0，不限制
+ */
+static int exmsg_poll_arm(void) {
+    int max_tmo = 0;
+
+    for (netif_t *netif = netif_first(); netif; netif = netif_next(netif)) {
+        if ((sys_atomic_load(&netif->state) != NETIF_ACTIVE) || !netif->ops->poll) {
+            continue;
+        }
+
+        if (!netif->ops->poll_arm || !netif->ops->poll_arm(netif)) {
+            max_tmo = EXMSG_POLL_SLEEP;
+        }
+    }
 
+    return max_tmo;
+}
+
+/**
+ * @brief 忙轮询模式的工作线程
+ *        不断轮询驱动和输入队列，数据包到达时无需经过消息通知和线程唤醒。
+ *        连续空闲EXMSG_POLL_IDLE_CNT轮后退回到阻塞等待消息，直到有数据包或消息到达才继续轮询
+ */
+static void poll_thread(void *arg) {
+    exmsg_worker_t *worker = (exmsg_worker_t *)arg;
+    dbg_info(DBG_MSG, "exmsg worker %d is polling...\n", worker->id);
+
+    net_timer_wheel_bind(&worker->timer_wheel);
+    curr_worker = worker;
+
+    int idle = 0;
+    sys_atomic_store(&worker->polling, 1);
     while (1) {
-        // 阻塞接收消息
-        exmsg_t *msg = (exmsg_t *)fixq_recv(&msg_queue, 0);
-        if (msg == (exmsg_t*)0) {
+        // 先处理其它线程发来的消息，不等待
+        int cnt = 0;
+        mpscq_node_t *node;
+        while ((node = mpscq_recv(&worker->msg_queue, -1)) != (mpscq_node_t *)0) {
+            exmsg_t *msg = mpscq_entry(node, exmsg_t, node);
+            exmsg_handle(msg);
+            cnt++;
+        }
+
+        cnt += exmsg_poll_list(worker);
+        cnt += exmsg_poll(worker);
+        cnt += net_timer_check_tmo(&worker->timer_wheel);
+        if (cnt > 0) {
+            idle = 0;
             continue;
         }
 
-        // 打印接收到消息的具体信息
-        dbg_info(DBG_MSG, "recieve a msg(%p): %d", msg, msg->type);
-        switch (msg->type) {
-        case NET_EXMSG_NETIF_IN:          // 网络接口消息
-            do_netif_in(msg);
-            break;
+        if (++idle < EXMSG_POLL_IDLE_CNT) {
+            sys_cpu_relax();
+            continue;
         }
 
-        // 释放消息
-        mblock_free(&msg_block, msg);
+        // 长时间空闲，退回到阻塞等待。先清除标志再检查一次输入队列，
+        // 避免漏掉标志清除前已入队、但生产者认为无需通知的数据包
+        // 0号线程还负责轮询驱动，先让驱动在有数据到达时通知，再检查一次驱动。
+        // 无法通知的驱动只能定时轮询
+        sys_atomic_store(&worker->polling, 0);
+        sys_atomic_fence();
+        int max_tmo = worker->id ? 0 : exmsg_poll_arm();
+        while ((exmsg_poll(worker) == 0) && nlist_is_empty(&worker->poll_list)) {
+            // 有定时器时最多等到其到期
+            node = mpscq_recv(&worker->msg_queue, exmsg_wait_tmo(worker, max_tmo));
+            net_timer_check_tmo(&worker->timer_wheel);
+
+            // 只有消息到达才恢复忙轮询，超时或只有定时器到期时继续等待
+            exmsg_t *msg = mpscq_entry(node, exmsg_t, node);
+            if (msg) {
+                exmsg_handle(msg);
+                break;
+            }
+        }
+
+        sys_atomic_store(&worker->polling, 1);
+        idle = 0;
     }
 }
+#endif // EXMSG_BUSY_POLL
 
 /**
  * @brief 启动核心线程通信机制
+ *        配置了EXMSG_WORKER_CPU时，各工作线程依次绑定到不同的cpu上，绑定失败不影响运行
  */
 net_err_t exmsg_start(void) {
-    sys_thread_t thread = sys_thread_create(work_thread, (void*)0);
-    if (thread == SYS_THREAD_INVALID) {
-        return NET_ERR_SYS;
+    for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+#if EXMSG_BUSY_POLL
+        sys_thread_t thread = sys_thread_create(poll_thread, &workers[i]);
+#else
+        sys_thread_t thread = sys_thread_create(work_thread, &workers[i]);
+#endif
+        if (thread == SYS_THREAD_INVALID) {
+            return NET_ERR_SYS;
+        }
+
+        if ((EXMSG_WORKER_CPU >= 0) && (sys_thread_bind_cpu(thread, EXMSG_WORKER_CPU + i) < 0)) {
+            dbg_warning(DBG_MSG, "bind worker %d to cpu %d failed.", i, EXMSG_WORKER_CPU + i);
+        }
     }
+    sys_atomic_store(&workers_started, 1);
+
+    return NET_ERR_OK;
 }
\ No newline at end of file
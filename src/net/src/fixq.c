@@ -14,6 +14,13 @@
 #include "sys.h"
 #include "sys_plat.h"
 
+// 布局检查：生产者与消费者修改的字段位于不同的缓存行，且都不与锁及只读字段共享缓存行
+dbg_static_assert(SYS_CACHE_LINE_OF(fixq_t, in) != SYS_CACHE_LINE_OF(fixq_t, out), fixq_in_out);
+dbg_static_assert(SYS_CACHE_LINE_OF(fixq_t, prod_wait) == SYS_CACHE_LINE_OF(fixq_t, in), fixq_prod_line);
+dbg_static_assert(SYS_CACHE_LINE_OF(fixq_t, cons_wait) == SYS_CACHE_LINE_OF(fixq_t, out), fixq_cons_line);
+dbg_static_assert(SYS_CACHE_LINE_OF(fixq_t, cnt) < SYS_CACHE_LINE_OF(fixq_t, in), fixq_lock_line);
+dbg_static_assert(SYS_CACHE_LINE_OF(fixq_t, send_sem) < SYS_CACHE_LINE_OF(fixq_t, locker), fixq_ro_line);
+
 /**
  * @brief 初始化定长消息队列
  */
@@ -23,6 +30,9 @@ net_err_t fixq_init(fixq_t *q, void **buf, int size, nlocker_type_t type) {
     q->buf = (void *)0;
     q->send_sem = SYS_SEM_INVALID;
     q->recv_sem = SYS_SEM_INVALID;
+    q->spsc = 0;
+    q->prod = q->cons = 0;
+    q->prod_wait = q->cons_wait = 0;
 
     net_err_t err = nlocker_init(&q->locker, type);
     if (err < 0) {
@@ -36,7 +46,7 @@ net_err_t fixq_init(fixq_t *q, void **buf, int size, nlocker_type_t type) {
         goto init_failed;  // 不能直接return，因为需要对已经初始化的锁进行回收
     }
 
-    q->recv_sem = sys_sem_create(size);
+    q->recv_sem = sys_sem_create(0);
     if (q->recv_sem == SYS_SEM_INVALID) {
         dbg_error(DBG_QUEUE, "init recv sem failed.");
         goto init_failed;  // 不能直接return，因为需要对已经初始化的锁进行回收
@@ -60,11 +70,162 @@ init_failed:
     return err;
 }
 
+/**
+ * @brief 初始化单生产者/单消费者的无锁消息队列
+ *        只允许一个线程写入、一个线程读取，如网卡接收线程向核心线程传递数据包。
+ *        收发不加锁，只在队列由空变为非空（或由满变为非满）且对方正在等待时才通知信号量
+ *
+ *        注意：读取（包括关闭接口时清空队列）只能在拥有该队列的消费者线程中进行，
+ *        其它线程需要清空队列时，应交给该线程处理，见exmsg_func_exec
+ */
+net_err_t fixq_init_spsc(fixq_t *q, void **buf, int size) {
+    q->size = size;
+    q->in = q->out = q->cnt = 0;
+    q->buf = (void *)0;
+    q->spsc = 1;
+    q->prod = q->cons = 0;
+    q->prod_wait = q->cons_wait = 0;
+    q->locker.type = NLOCKER_NONE;
+
+    q->send_sem = sys_sem_create(0);
+    if (q->send_sem == SYS_SEM_INVALID) {
+        dbg_error(DBG_QUEUE, "init send sem failed.");
+        return NET_ERR_SYS;
+    }
+
+    q->recv_sem = sys_sem_create(0);
+    if (q->recv_sem == SYS_SEM_INVALID) {
+        dbg_error(DBG_QUEUE, "init recv sem failed.");
+        sys_sem_free(q->send_sem);
+        q->send_sem = SYS_SEM_INVALID;
+        return NET_ERR_SYS;
+    }
+
+    q->buf = buf;
+    return NET_ERR_OK;
+}
+
+/**
+ * @brief 无锁模式下等待对方的通知
+ *        先置等待标志，再检查条件，对方修改计数后检查等待标志，两者之间各有一个全屏障，
+ *        保证不会出现双方都没有看到对方修改的情况
+ *
+ * @param wait 自己的等待标志
+ * @param idx 对方修改的计数，其值不再等于old时停止等待
+ * @return 0 条件已满足，<0 超时
+ */
+static int spsc_wait(sys_sem_t sem, int *wait, int *idx, int old, int tmo) {
+    sys_atomic_store(wait, 1);
+    sys_atomic_fence();
+    if (sys_atomic_load(idx) != old) {
+        // 对方若已经清除了等待标志，会多通知一次信号量，只会导致下次多一次空唤醒
+        sys_atomic_xchg(wait, 0);
+        return 0;
+    }
+
+    int err = sys_sem_wait(sem, tmo);
+    sys_atomic_xchg(wait, 0);
+    return err;
+}
+
+/**
+ * @brief 无锁模式下通知正在等待的对方
+ */
+static void spsc_wakeup(sys_sem_t sem, int *wait) {
+    sys_atomic_fence();
+    if (sys_atomic_load(wait) && sys_atomic_xchg(wait, 0)) {
+        sys_sem_notify(sem);
+    }
+}
+
+/**
+ * @brief 无锁模式下的计数在[0, 2 * size)内循环，以区分队列空（两者相等）和队列满（相差size）
+ */
+static inline int spsc_next(fixq_t *q, int idx) {
+    return (idx + 1 == q->size * 2) ? 0 : idx + 1;
+}
+
+static inline int spsc_count(fixq_t *q, int prod, int cons) {
+    return (prod >= cons) ? prod - cons : prod + q->size * 2 - cons;
+}
+
+static inline void **spsc_slot(fixq_t *q, int idx) {
+    return &q->buf[idx >= q->size ? idx - q->size : idx];
+}
+
+/**
+ * @brief 无锁模式下写入最多cnt个消息，队列满时按tmo等待至少有一个空闲单元
+ * @return 实际写入的数量，失败时返回错误码
+ */
+static int spsc_send_many(fixq_t *q, void **msgs, int cnt, int tmo) {
+    int prod = q->prod;
+
+    // 队列满时等待消费者取走消息
+    int cons, free_cnt;
+    while ((free_cnt = q->size - spsc_count(q, prod, cons = sys_atomic_load(&q->cons))) <= 0) {
+        if (tmo < 0) {
+            return NET_ERR_FULL;
+        }
+
+        if (spsc_wait(q->send_sem, &q->prod_wait, &q->cons, cons, tmo) < 0) {
+            return NET_ERR_TMO;
+        }
+    }
+
+    // 写入全部消息后只发布一次
+    int n = cnt < free_cnt ? cnt : free_cnt;
+    for (int i = 0; i < n; i++) {
+        *spsc_slot(q, prod) = msgs[i];
+        prod = spsc_next(q, prod);
+    }
+    sys_atomic_store(&q->prod, prod);
+
+    spsc_wakeup(q->recv_sem, &q->cons_wait);
+    return n;
+}
+
+/**
+ * @brief 无锁模式下取最多cnt个消息，队列空时按tmo等待至少有一个消息
+ * @return 实际取出的数量
+ */
+static int spsc_recv_many(fixq_t *q, void **msgs, int cnt, int tmo) {
+    int cons = q->cons;
+
+    // 队列空时等待生产者写入消息
+    int prod;
+    while ((prod = sys_atomic_load(&q->prod)) == cons) {
+        if (tmo < 0) {
+            return 0;
+        }
+
+        if (spsc_wait(q->recv_sem, &q->cons_wait, &q->prod, cons, tmo) < 0) {
+            return 0;
+        }
+    }
+
+    // 取出全部消息后只发布一次
+    int n = spsc_count(q, prod, cons);
+    n = cnt < n ? cnt : n;
+    for (int i = 0; i < n; i++) {
+        msgs[i] = *spsc_slot(q, cons);
+        cons = spsc_next(q, cons);
+    }
+    sys_atomic_store(&q->cons, cons);
+
+    spsc_wakeup(q->send_sem, &q->prod_wait);
+    return n;
+}
+
 /**
  * @brief 向消息队列写入一个消息
  *        如果消息队列满，则看tmo，如果tmo < 0则不等待
  */
 net_err_t fixq_send(fixq_t *q, void *msg, int tmo) {
+    if (q->spsc) {
+        int err = spsc_send_many(q, &msg, 1, tmo);
+        return err < 0 ? err : NET_ERR_OK;
+    }
+
     // 第一组锁定，检查是否满
     nlocker_lock(&q->locker);
     if ((q->cnt >= q->size) && (tmo < 0)) {
@@ -104,6 +265,12 @@ net_err_t fixq_send(fixq_t *q, void *msg, int tmo) {
  * @brief 从消息队列中取一个消息
  */
 void *fixq_recv(fixq_t *q, int tmo) {
+    if (q->spsc) {
+        void *msg = (void *)0;
+        spsc_recv_many(q, &msg, 1, tmo);
+        return msg;
+    }
+
     // 第一组锁定，检查当前队列中是否有消息
     nlocker_lock(&q->locker);
     if ((!q->cnt) && (tmo < 0)) {
@@ -137,6 +304,105 @@ void *fixq_recv(fixq_t *q, int tmo) {
     return msg;
 }
 
+/**
+ * @brief 向消息队列一次写入最多cnt个消息
+ *        只加锁一次、批量调整信号量。队列满时按tmo等待（tmo < 0则不等待），
+ *        有空闲单元后写入尽可能多的消息，不保证全部写入
+ * @return 实际写入的数量，失败时返回错误码
+ */
+int fixq_send_many(fixq_t *q, void **msgs, int cnt, int tmo) {
+    if (cnt <= 0) {
+        return 0;
+    }
+
+    if (q->spsc) {
+        return spsc_send_many(q, msgs, cnt, tmo);
+    }
+
+    // 预占空闲单元，一个都没有时才等待
+    int reserved = sys_sem_try_wait_n(q->send_sem, cnt);
+    if (reserved == 0) {
+        if (tmo < 0) {
+            return NET_ERR_FULL;
+        }
+
+        if (sys_sem_wait(q->send_sem, tmo) < 0) {
+            return NET_ERR_TMO;
+        }
+        reserved = 1 + sys_sem_try_wait_n(q->send_sem, cnt - 1);
+    }
+
+    nlocker_lock(&q->locker);
+    int n = q->size - q->cnt;
+    n = reserved < n ? reserved : n;
+    for (int i = 0; i < n; i++) {
+        q->buf[q->in++] = msgs[i];
+        if (q->in >= q->size) {
+            q->in = 0;
+        }
+    }
+    q->cnt += n;
+    nlocker_unlock(&q->locker);
+
+    // 归还未使用的空闲单元，再通知有消息可用
+    if (reserved > n) {
+        sys_sem_notify_n(q->send_sem, reserved - n);
+    }
+    if (n == 0) {
+        return NET_ERR_FULL;
+    }
+    sys_sem_notify_n(q->recv_sem, n);
+
+    return n;
+}
+
+/**
+ * @brief 从消息队列中一次取最多cnt个消息
+ *        只加锁一次、批量调整信号量。队列空时按tmo等待（tmo < 0则不等待）
+ * @return 实际取出的数量，没有消息时返回0
+ */
+int fixq_recv_many(fixq_t *q, void **msgs, int cnt, int tmo) {
+    if (cnt <= 0) {
+        return 0;
+    }
+
+    if (q->spsc) {
+        return spsc_recv_many(q, msgs, cnt, tmo);
+    }
+
+    int reserved = sys_sem_try_wait_n(q->recv_sem, cnt);
+    if (reserved == 0) {
+        if (tmo < 0) {
+            return 0;
+        }
+
+        if (sys_sem_wait(q->recv_sem, tmo) < 0) {
+            return 0;
+        }
+        reserved = 1 + sys_sem_try_wait_n(q->recv_sem, cnt - 1);
+    }
+
+    nlocker_lock(&q->locker);
+    int n = reserved < q->cnt ? reserved : q->cnt;
+    for (int i = 0; i < n; i++) {
+        msgs[i] = q->buf[q->out++];
+        if (q->out >= q->size) {
+            q->out = 0;
+        }
+    }
+    q->cnt -= n;
+    nlocker_unlock(&q->locker);
+
+    if (reserved > n) {
+        sys_sem_notify_n(q->recv_sem, reserved - n);
+    }
+    if (n > 0) {
+        sys_sem_notify_n(q->send_sem, n);
+    }
+
+    return n;
+}
+
 /**
  * @brief 消息队列销毁
 */
@@ -150,6 +416,10 @@ void fixq_destroy(fixq_t *q) {
  * @brief 计数消息队列
 */
 int fixq_count(fixq_t *q) {
+    if (q->spsc) {
+        return spsc_count(q, sys_atomic_load(&q->prod), sys_atomic_load(&q->cons));
+    }
+
     nlocker_lock(&q->locker);
     int count = q->cnt;
     nlocker_unlock(&q->locker);
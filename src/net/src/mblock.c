@@ -4,6 +4,125 @@
 #include "sys_plat.h"
 #include "dbg.h"
 
+// 布局检查：只读字段不与锁、空闲链表及无锁栈顶共享缓存行
+dbg_static_assert(SYS_CACHE_LINE_OF(mblock_t, alloc_sem) < SYS_CACHE_LINE_OF(mblock_t, locker), mblock_ro_line);
+dbg_static_assert(SYS_CACHE_LINE_OF(mblock_t, lf_waiters) == SYS_CACHE_LINE_OF(mblock_t, locker), mblock_hot_line);
+
+/**
+ * NLOCKER_LOCKFREE模式：空闲块组成Treiber无锁栈
+ * 栈顶lf_top为64位，低32位为栈顶块的序号+1，高32位为版本号，每次修改栈顶时加1。
+ * 这样即使栈顶在两次读取之间被取走又放回（ABA），版本号也不同，CAS会失败
+ */
+#define LF_IDX(top)             ((uint32_t)(top))
+#define LF_TAG(top)             ((uint32_t)((top) >> 32))
+#define LF_MAKE(tag, idx)       (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+
+static inline void *lf_block(mblock_t *mblock, uint32_t idx) {
+    return (uint8_t *)mblock->start + (idx - 1) * mblock->blk_size;
+}
+
+static inline uint32_t lf_index(mblock_t *mblock, void *block) {
+    return (uint32_t)(((uint8_t *)block - (uint8_t *)mblock->start) / mblock->blk_size) + 1;
+}
+
+// 空闲块中存放的下一个空闲块的序号，可能与其它线程并发读写，使用原子访问
+static inline uint32_t lf_next(void *block) {
+    return __atomic_load_n((uint32_t *)block, __ATOMIC_RELAXED);
+}
+
+static inline void lf_set_next(void *block, uint32_t idx) {
+    __atomic_store_n((uint32_t *)block, idx, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 从无锁栈中一次取出最多cnt个存储块，只需一次CAS
+ *        栈顶版本号未变时，栈顶以下的结点也不会变化，因此可以沿链取多个
+ */
+static int lf_pop(mblock_t *mblock, void **blocks, int cnt) {
+    uint64_t top = __atomic_load_n(&mblock->lf_top, __ATOMIC_SEQ_CST);
+    while (1) {
+        uint32_t next = LF_IDX(top);
+        int n = 0;
+        while ((n < cnt) && next) {
+            blocks[n++] = lf_block(mblock, next);
+            next = lf_next(blocks[n - 1]);
+
+            // 读取期间存储块可能已被其它线程取走并写入了数据，序号无效时重新读取栈顶
+            if (next > (uint32_t)mblock->blk_cnt) {
+                break;
+            }
+        }
+
+        if (next > (uint32_t)mblock->blk_cnt) {
+            top = __atomic_load_n(&mblock->lf_top, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        if (n == 0) {
+            return 0;
+        }
+
+        if (__atomic_compare_exchange_n(&mblock->lf_top, &top, LF_MAKE(LF_TAG(top) + 1, next),
+                                        0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return n;
+        }
+    }
+}
+
+/**
+ * @brief 将cnt个存储块一次压入无锁栈，有线程在等待时才通知信号量
+ */
+static void lf_push(mblock_t *mblock, void **blocks, int cnt) {
+    // 先在本地将存储块链接起来，最后一个块指向原栈顶
+    for (int i = 0; i < cnt - 1; i++) {
+        lf_set_next(blocks[i], lf_index(mblock, blocks[i + 1]));
+    }
+
+    uint32_t first = lf_index(mblock, blocks[0]);
+    uint64_t top = __atomic_load_n(&mblock->lf_top, __ATOMIC_RELAXED);
+    do {
+        lf_set_next(blocks[cnt - 1], LF_IDX(top));
+    } while (!__atomic_compare_exchange_n(&mblock->lf_top, &top, LF_MAKE(LF_TAG(top) + 1, first),
+                                          0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if (__atomic_load_n(&mblock->lf_waiters, __ATOMIC_SEQ_CST) > 0) {
+        sys_sem_notify_n(mblock->alloc_sem, cnt);
+    }
+}
+
+/**
+ * @brief 从无锁栈中分配一个存储块
+ *        栈空且需要等待时，先登记为等待者再检查一次，再在信号量上等待
+ */
+static void *lf_alloc(mblock_t *mblock, int ms) {
+    void *block;
+    if (lf_pop(mblock, &block, 1)) {
+        return block;
+    }
+
+    if (ms < 0) {
+        return (void *)0;
+    }
+
+    while (1) {
+        __atomic_add_fetch(&mblock->lf_waiters, 1, __ATOMIC_SEQ_CST);
+        if (lf_pop(mblock, &block, 1)) {
+            __atomic_sub_fetch(&mblock->lf_waiters, 1, __ATOMIC_SEQ_CST);
+            return block;
+        }
+
+        int err = sys_sem_wait(mblock->alloc_sem, ms);
+        __atomic_sub_fetch(&mblock->lf_waiters, 1, __ATOMIC_SEQ_CST);
+        if (lf_pop(mblock, &block, 1)) {
+            return block;
+        }
+
+        if (err < 0) {
+            return (void *)0;
+        }
+    }
+}
+
 /**
  * @brief 初始化存储块管理器
  *        将mem开始的内存区域划分成多个相同大小的内存块，然后用链表链接起来
@@ -17,21 +136,36 @@ net_err_t mblock_init(mblock_t *mblock, void *mem, int blk_size, int cnt, nlocke
     // 链表使用了nlist_node结构，所以大小必须合适
     dbg_assert(blk_size >= sizeof(nlist_node_t), "size error");
 
+    mblock->start = mem;
+    mblock->blk_size = blk_size;
+    mblock->blk_cnt = cnt;
+    mblock->lf_top = 0;
+    mblock->lf_waiters = 0;
+
     // 将缓存区分割成一块块固定大小内存，插入到队列中
     uint8_t *buf = (uint8_t *)mem;
     nlist_init(&mblock->free_list);
-    for (int i=0; i<cnt; i++,buf+=blk_size) {
+    for (int i=0; (lokcer_type != NLOCKER_LOCKFREE) && (i<cnt); i++,buf+=blk_size) {
         nlist_node_t *block = (nlist_node_t *)buf;
         nlist_node_init(block);
         nlist_insert_last(&mblock->free_list, block);
     }
 
+    // 无锁模式：所有块依次链接，第一个块为栈顶
+    if ((lokcer_type == NLOCKER_LOCKFREE) && (cnt > 0)) {
+        for (int i = 0; i < cnt; i++, buf += blk_size) {
+            lf_set_next(buf, (i + 1 < cnt) ? i + 2 : 0);
+        }
+        mblock->lf_top = LF_MAKE(0, 1);
+    }
+
     nlocker_init(&mblock->locker, lokcer_type);
     
     // 涉及多线程时才分配信号量
     // 如果只是线程内部使用，则不需要分配信号量
+    // 无锁模式下信号量只用于等待，计数不代表空闲块数量
     if (lokcer_type != NLOCKER_NONE) {
-        mblock->alloc_sem = sys_sem_create(cnt);
+        mblock->alloc_sem = sys_sem_create(lokcer_type == NLOCKER_LOCKFREE ? 0 : cnt);
         if (mblock->alloc_sem == SYS_SEM_INVALID) {
             dbg_error(DBG_MBLOCK, "create sem failed.");
             nlocker_destroy(&mblock->locker);
@@ -39,7 +173,6 @@ net_err_t mblock_init(mblock_t *mblock, void *mem, int blk_size, int cnt, nlocke
         }
     }
 
-    // mblock->start = mem;
     return NET_ERR_OK;
 }
 
@@ -47,6 +180,10 @@ net_err_t mblock_init(mblock_t *mblock, void *mem, int blk_size, int cnt, nlocke
  * @brief 分配一个空闲的存储块
  */
 void *mblock_alloc(mblock_t *mblock, int ms) {
+    if (mblock->locker.type == NLOCKER_LOCKFREE) {
+        return lf_alloc(mblock, ms);
+    }
+
     // 不需要等待信号量，查询后直接退出
     // 有两种情况：1）ms < 0；2）此时是用于线程内部的分配
     if ((ms < 0) || (mblock->locker.type == NLOCKER_NONE)) {
@@ -72,10 +209,57 @@ void *mblock_alloc(mblock_t *mblock, int ms) {
     return block;
 }
 
+/**
+ * @brief 批量分配空闲的存储块，不等待
+ *        只加锁一次，从空闲链表中取下最多cnt个存储块，信号量也只调整一次
+ *
+ * @param blocks 存放分配得到的存储块
+ * @return 实际分配的数量
+ */
+int mblock_alloc_bulk(mblock_t *mblock, void **blocks, int cnt) {
+    if (mblock->locker.type == NLOCKER_LOCKFREE) {
+        return cnt > 0 ? lf_pop(mblock, blocks, cnt) : 0;
+    }
+
+    // 先从信号量中预留，预留成功的数量一定能在空闲链表中取到
+    if (mblock->locker.type != NLOCKER_NONE) {
+        cnt = sys_sem_try_wait_n(mblock->alloc_sem, cnt);
+    }
+
+    int n = 0;
+    nlocker_lock(&mblock->locker);
+    while (n < cnt) {
+        nlist_node_t *block = nlist_remove_first(&mblock->free_list);
+        if (!block) {
+            break;
+        }
+        blocks[n++] = block;
+    }
+    nlocker_unlock(&mblock->locker);
+
+    // 预留多了，归还多余的部分
+    if ((mblock->locker.type != NLOCKER_NONE) && (n < cnt)) {
+        sys_sem_notify_n(mblock->alloc_sem, cnt - n);
+    }
+
+    return n;
+}
+
 /**
  * @brief 获取空闲块数量
  */
 int mblock_free_cnt(mblock_t *mblock) {
+    // 无锁模式下沿栈统计，结果只是某一时刻的近似值，仅用于调试
+    if (mblock->locker.type == NLOCKER_LOCKFREE) {
+        int cnt = 0;
+        uint32_t idx = LF_IDX(__atomic_load_n(&mblock->lf_top, __ATOMIC_ACQUIRE));
+        while (idx && (idx <= (uint32_t)mblock->blk_cnt) && (cnt < mblock->blk_cnt)) {
+            cnt++;
+            idx = lf_next(lf_block(mblock, idx));
+        }
+        return cnt;
+    }
+
     nlocker_lock(&mblock->locker);
     int cnt = nlist_count(&mblock->free_list);
     nlocker_unlock(&mblock->locker);
@@ -87,6 +271,11 @@ int mblock_free_cnt(mblock_t *mblock) {
  * @brief 释放存储块
  */
 void mblock_free(mblock_t *mblock, void *block) {
+    if (mblock->locker.type == NLOCKER_LOCKFREE) {
+        lf_push(mblock, &block, 1);
+        return;
+    }
+
     nlocker_lock(&mblock->locker);
     // 将要释放的存储块加入空闲链表
     nlist_insert_last(&mblock->free_list, (nlist_node_t *)block);
@@ -99,6 +288,31 @@ void mblock_free(mblock_t *mblock, void *block) {
     }
 }
 
+/**
+ * @brief 批量释放存储块
+ *        只加锁一次，将cnt个存储块加入空闲链表，信号量也只调整一次
+ */
+void mblock_free_bulk(mblock_t *mblock, void **blocks, int cnt) {
+    if (cnt <= 0) {
+        return;
+    }
+
+    if (mblock->locker.type == NLOCKER_LOCKFREE) {
+        lf_push(mblock, blocks, cnt);
+        return;
+    }
+
+    nlocker_lock(&mblock->locker);
+    for (int i = 0; i < cnt; i++) {
+        nlist_insert_last(&mblock->free_list, (nlist_node_t *)blocks[i]);
+    }
+    nlocker_unlock(&mblock->locker);
+
+    if (mblock->locker.type != NLOCKER_NONE) {
+        sys_sem_notify_n(mblock->alloc_sem, cnt);
+    }
+}
+
 /**
  * @brief 销毁存储管理块
  */
@@ -0,0 +1,129 @@
+/**
+ * @file mpscq.c
+ * @brief 多生产者/单消费者无锁消息队列
+ *        采用Vyukov的侵入式MPSC队列：生产者用一次原子交换将结点挂到队尾，再链接到前一结点；
+ *        消费者从队头逐个取结点，不需要任何锁。队列空时，消费者在信号量上等待，
+ *        生产者只在消费者确实处于等待状态时才通知信号量
+ */
+
+#include "mpscq.h"
+#include "dbg.h"
+#include "net_err.h"
+#include "sys.h"
+#include "sys_plat.h"
+
+/**
+ * @brief 初始化消息队列
+ */
+net_err_t mpscq_init(mpscq_t *q) {
+    q->stub.next = (mpscq_node_t *)0;
+    q->head = q->tail = &q->stub;
+    q->cons_wait = 0;
+
+    q->recv_sem = sys_sem_create(0);
+    if (q->recv_sem == SYS_SEM_INVALID) {
+        dbg_error(DBG_QUEUE, "init recv sem failed.");
+        return NET_ERR_SYS;
+    }
+
+    return NET_ERR_OK;
+}
+
+/**
+ * @brief 销毁消息队列，队列中剩余的消息由调用者处理
+ */
+void mpscq_destroy(mpscq_t *q) {
+    sys_sem_free(q->recv_sem);
+}
+
+/**
+ * @brief 将结点挂到队尾
+ *        交换head之后、链接pre->next之前，消费者看到的队列是断开的，此时消费者会认为队列暂时为空
+ */
+static void mpscq_push(mpscq_t *q, mpscq_node_t *node) {
+    node->next = (mpscq_node_t *)0;
+    mpscq_node_t *pre = sys_atomic_xchg(&q->head, node);
+    sys_atomic_store(&pre->next, node);
+}
+
+/**
+ * @brief 向消息队列写入一个消息，可在任意线程中调用，不会阻塞
+ */
+void mpscq_send(mpscq_t *q, mpscq_node_t *node) {
+    mpscq_push(q, node);
+
+    // 与消费者的等待过程配对：先发布结点，再检查等待标志
+    sys_atomic_fence();
+    if (sys_atomic_load(&q->cons_wait) && sys_atomic_xchg(&q->cons_wait, 0)) {
+        sys_sem_notify(q->recv_sem);
+    }
+}
+
+/**
+ * @brief 从队头取一个结点，只能由消费者调用
+ * @return 取到的结点，队列空或生产者正在入队时返回0
+ */
+static mpscq_node_t *mpscq_pop(mpscq_t *q) {
+    mpscq_node_t *tail = q->tail;
+    mpscq_node_t *next = sys_atomic_load(&tail->next);
+
+    // 跳过哨兵结点
+    if (tail == &q->stub) {
+        if (!next) {
+            return (mpscq_node_t *)0;
+        }
+
+        q->tail = next;
+        tail = next;
+        next = sys_atomic_load(&tail->next);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    // tail后面没有结点，但tail不是最后入队的结点：有生产者正在入队，稍后再取
+    if (tail != sys_atomic_load(&q->head)) {
+        return (mpscq_node_t *)0;
+    }
+
+    // tail是队列中最后一个结点，重新挂入哨兵结点后才能将其取出
+    mpscq_push(q, &q->stub);
+    next = sys_atomic_load(&tail->next);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    return (mpscq_node_t *)0;
+}
+
+/**
+ * @brief 从消息队列中取一个消息，只能由一个线程调用
+ *        如果队列空，则看tmo，如果tmo < 0则不等待，tmo == 0一直等待
+ */
+mpscq_node_t *mpscq_recv(mpscq_t *q, int tmo) {
+    while (1) {
+        mpscq_node_t *node = mpscq_pop(q);
+        if (node || (tmo < 0)) {
+            return node;
+        }
+
+        // 先置等待标志再检查一次，避免与生产者同时错过对方
+        sys_atomic_store(&q->cons_wait, 1);
+        sys_atomic_fence();
+        node = mpscq_pop(q);
+        if (node) {
+            // 生产者若已清除标志，会多通知一次信号量，只会导致下次多一次空唤醒
+            sys_atomic_xchg(&q->cons_wait, 0);
+            return node;
+        }
+
+        int err = sys_sem_wait(q->recv_sem, tmo);
+        sys_atomic_xchg(&q->cons_wait, 0);
+        if (err < 0) {
+            return mpscq_pop(q);
+        }
+    }
+}
@@ -12,6 +12,15 @@
 #include "loop.h"
 #include "tools.h"
 
+static const pktbuf_cfg_t *pktbuf_cfg;          // 数据包池的配置，为0时使用缺省配置
+
+/**
+ * @brief 设置数据包池的大小，需在net_init之前调用
+ */
+void net_set_pktbuf_cfg(const pktbuf_cfg_t *cfg) {
+    pktbuf_cfg = cfg;
+}
+
 /**
  * @brief 协议栈初始化
  */
@@ -22,7 +31,7 @@ net_err_t net_init(void) {
     net_plat_init();  // 初始化硬件资源
     tools_init();
     exmsg_init();
-    pktbuf_init();
+    pktbuf_init(pktbuf_cfg);
     netif_init();
     loop_init();
     ether_init();
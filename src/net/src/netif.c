@@ -13,17 +13,33 @@
 #include "mblock.h"
 #include "net_err.h"
 #include "nlist.h"
+#include "nlocker.h"
 #include "pktbuf.h"
 #include "sys_plat.h"
 #include "exmsg.h"
+#include "ether.h"
+#include "protocol.h"
+#include "tools.h"
 
 static netif_t netif_buffer[NETIF_DEV_CNT];     // 整个系统所支持的、可供分配的网络接口
 static mblock_t netif_mblock;                   // 网络接口分配结构
 static nlist_t netif_list;                      // 放置整个系统中已经打开的网络接口
+static nlocker_t netif_locker;                  // 接口列表的锁，工作线程遍历时与打开、关闭接口互斥
 static netif_t *netif_default;                  // 缺省的网络接口
 
 static const link_layer_t *link_layers[NETIF_TYPE_SIZE];  // 当前协议栈支持的链路层结构
 
+/**
+ * @brief 软件RSS使用的Toeplitz哈希密钥，与常见网卡的缺省密钥相同
+ */
+static const uint8_t rss_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
 /**
  * @brief 显示系统中的网卡列表信息
  */
@@ -81,6 +97,11 @@ net_err_t netif_init(void) {
 
     // 建立接口列表
     nlist_init(&netif_list);
+    net_err_t err = nlocker_init(&netif_locker, NLOCKER_SPIN);
+    if (err < 0) {
+        dbg_error(DBG_NETIF, "netif locker init failed.");
+        return err;
+    }
     mblock_init(&netif_mblock, netif_buffer, sizeof(netif_t), NETIF_DEV_CNT, NLOCKER_NONE);
 
     // 设置缺省接口
@@ -150,17 +171,37 @@ netif_t *netif_open(const char *dev_name, const netif_ops_t *ops, void *ops_data
     // 初始化链接节点，用于链接其他网络接口
     nlist_node_init(&netif->node);
 
-    // 初始化输入/出队列以及对应的缓冲空间
-    net_err_t err = fixq_init(&netif->in_q, netif->in_q_buf, NETIF_INQ_SIZE, NLOCKER_THREAD);
-    if (err < 0) {
-        dbg_error(DBG_NETIF, "netif in_q init failed.");
-        fixq_destroy(&netif->in_q);
-        return (netif_t *)0;
+    // 初始化输入/出队列以及对应的缓冲空间，每个工作线程一个输入队列
+    // 驱动只有一个接收线程时，每个输入队列只有一个生产者、一个消费者，可使用无锁模式
+    net_err_t err = NET_ERR_OK;
+    for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+#if NETIF_INQ_SPSC
+        if (ops->rx_single) {
+            err = fixq_init_spsc(&netif->in_q[i], netif->in_q_buf[i], NETIF_INQ_SIZE);
+        } else
+#endif
+        {
+            err = fixq_init(&netif->in_q[i], netif->in_q_buf[i], NETIF_INQ_SIZE, NETIF_INQ_LOCKER);
+        }
+        if (err < 0) {
+            dbg_error(DBG_NETIF, "netif in_q init failed.");
+            while (--i >= 0) {
+                fixq_destroy(&netif->in_q[i]);
+            }
+            mblock_free(&netif_mblock, netif);
+            return (netif_t *)0;
+        }
+        netif->rx_pending[i] = 0;
+        nlist_node_init(&netif->poll_node[i]);
     }
-    err = fixq_init(&netif->out_q, netif->out_q_buf, NETIF_INQ_SIZE, NLOCKER_THREAD);
+    netif->weight = NETIF_WEIGHT;
+    err = fixq_init(&netif->out_q, netif->out_q_buf, NETIF_OUTQ_SIZE, NETIF_OUTQ_LOCKER);
     if (err < 0) {
         dbg_error(DBG_NETIF, "netif out_q init failed.");
-        fixq_destroy(&netif->out_q);
+        for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+            fixq_destroy(&netif->in_q[i]);
+        }
+        mblock_free(&netif_mblock, netif);
         return (netif_t *)0;
     }
 
@@ -177,27 +218,30 @@ netif_t *netif_open(const char *dev_name, const netif_ops_t *ops, void *ops_data
     // 做一些必要性的检查，以免驱动没写好
     if (netif->type == NETIF_TYPE_NONE) {
         dbg_error(DBG_NETIF, "netif type unknown");
-        goto free_return;
+        goto close_return;
     }
 
     // 获取驱动层接口
     netif->link_layer = netif_get_layer(netif->type);
     if (!netif->link_layer && (netif->type != NETIF_TYPE_LOOP)) {
         dbg_error(DBG_NETIF, "no link layer. netif name: %s", dev_name);
-        goto free_return;
+        goto close_return;
     }
 
     // 将打开的网络接口加入整个系统中已打开的网络接口列表中
+    nlocker_lock(&netif_locker);
     nlist_insert_last(&netif_list, &netif->node);
+    nlocker_unlock(&netif_locker);
     display_netif_list();
     return netif;
 
+close_return:
+    // 驱动已打开成功，需要关闭；打开失败时驱动自行清理，不能再关闭
+    netif->ops->close(netif);
 free_return:
-    if (netif->state == NETIF_OPENED) {
-        netif->ops->close(netif);
+    for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+        fixq_destroy(&netif->in_q[i]);
     }
-
-    fixq_destroy(&netif->in_q);
     fixq_destroy(&netif->out_q);
     mblock_free(&netif_mblock, netif);
 
@@ -252,8 +296,9 @@ net_err_t netif_set_active(netif_t *netif) {
         netif_set_default(netif);
     }
 
-    // 切换为就绪状态
-    netif->state = NETIF_ACTIVE;
+    // 切换为就绪状态，恢复接收通知
+    sys_atomic_store(&netif->state, NETIF_ACTIVE);
+    exmsg_netif_attach(netif);
 
     display_netif_list();
     return NET_ERR_OK;
@@ -274,19 +319,17 @@ net_err_t netif_set_deactive(netif_t *netif) {
         netif->link_layer->close(netif);
     }
 
-    // 释放相关资源
+    // 先切换状态，工作线程不再轮询该接口，再释放相关资源
+    // 输入队列可能是只能由工作线程读取的无锁队列，交给各工作线程自己移出轮询列表并清空
+    sys_atomic_store(&netif->state, NETIF_OPENED);
+    exmsg_netif_detach(netif);
+
     pktbuf_t *buf;
-    while ((buf = fixq_recv(&netif->in_q, -1)) != (pktbuf_t *)0) {
-        // 释放接收队列中的数据包
-        pktbuf_free(buf);
-    }
     while ((buf = fixq_recv(&netif->out_q, -1)) != (pktbuf_t *)0) {
         // 释放发送队列中的数据包
         pktbuf_free(buf);
     }
 
-    // 恢复到打开但未激活的状态
-    netif->state = NETIF_OPENED;
     display_netif_list();
     return NET_ERR_OK;
 }
@@ -302,10 +345,24 @@ net_err_t netif_close(netif_t *netif) {
 
     // 先关闭内部设备
     netif->ops->close(netif);
-    netif->state = NETIF_CLOSED;
+    sys_atomic_store(&netif->state, NETIF_CLOSED);
 
-    // 再释放netif结构
+    // 再释放netif结构。先从接口列表中移除，再从各工作线程中移除：
+    // 返回时各线程都已处理完一个消息，不会再在轮询列表或遍历中引用该接口
+    nlocker_lock(&netif_locker);
     nlist_remove(&netif_list, &netif->node);
+    nlocker_unlock(&netif_locker);
+    exmsg_netif_detach(netif);
+
+    // 此时已没有线程访问各队列，输入队列已在工作线程中清空
+    pktbuf_t *buf;
+    while ((buf = fixq_recv(&netif->out_q, -1)) != (pktbuf_t *)0) {
+        pktbuf_free(buf);
+    }
+    for (int i = 0; i < EXMSG_WORKER_CNT; i++) {
+        fixq_destroy(&netif->in_q[i]);
+    }
+    fixq_destroy(&netif->out_q);
     mblock_free(&netif_mblock, netif);
 
     display_netif_list();
@@ -320,23 +377,189 @@ void netif_set_default(netif_t *netif) {
     netif_default = netif;
 }
 
+/**
+ * @brief 设置接口的权重，即工作线程每轮最多从该接口处理的数据包数量
+ *        权重越大，接口繁忙时分到的处理时间越多
+ */
+net_err_t netif_set_weight(netif_t *netif, int weight) {
+    if (weight <= 0) {
+        dbg_error(DBG_NETIF, "weight error: %d", weight);
+        return NET_ERR_PARAM;
+    }
+
+    netif->weight = weight;
+    return NET_ERR_OK;
+}
+
+/**
+ * @brief 获取第一个已打开的网络接口，与netif_next配合遍历所有接口
+ *        工作线程遍历时其它线程可能正在打开或关闭接口，因此每一步都加锁，
+ *        但只在取下一个接口时持有锁，处理接口期间不持有。
+ *        遍历期间被关闭的接口，其next为空，本次遍历提前结束；其结构要等各工作线程
+ *        都处理完一个消息后才释放（见netif_close），因此遍历期间总是有效的
+ */
+netif_t *netif_first(void) {
+    nlocker_lock(&netif_locker);
+    nlist_node_t *node = nlist_first(&netif_list);
+    nlocker_unlock(&netif_locker);
+    return nlist_entry(node, netif_t, node);
+}
+
+/**
+ * @brief 获取下一个已打开的网络接口
+ */
+netif_t *netif_next(netif_t *netif) {
+    nlocker_lock(&netif_locker);
+    nlist_node_t *node = nlist_node_next(&netif->node);
+    nlocker_unlock(&netif_locker);
+    return nlist_entry(node, netif_t, node);
+}
+
+/**
+ * @brief 计算Toeplitz哈希
+ *        输入数据的每个置位比特，都将密钥中从该比特位置开始的32位异或到结果中
+ */
+static uint32_t rss_toeplitz(const uint8_t *data, int len) {
+    uint32_t hash = 0;
+    uint32_t window = ((uint32_t)rss_key[0] << 24) | ((uint32_t)rss_key[1] << 16) | ((uint32_t)rss_key[2] << 8) | rss_key[3];
+
+    for (int i = 0; i < len; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            if (data[i] & (1 << bit)) {
+                hash ^= window;
+            }
+            window = (window << 1) | ((rss_key[i + 4] >> bit) & 0x1);
+        }
+    }
+
+    return hash;
+}
+
+/**
+ * @brief 为输入的数据包选择处理它的工作线程（软件RSS）
+ *        对IPv4的源/目的地址，以及TCP/UDP的源/目的端口做哈希，同一条流总是交给同一个工作线程，
+ *        IP分片只使用地址，保证同一个IP包的各分片到达同一个线程。非IPv4的数据包（如ARP）交给0号线程
+ */
+static int netif_select_worker(netif_t *netif, pktbuf_t *buf) {
+#if EXMSG_WORKER_CNT > 1
+    uint8_t scratch[20];
+    uint8_t tuple[12];                  // 源地址、目的地址、源端口、目的端口
+    int offset = 0;
+
+    // 以太网帧跳过包头，环回接口中的数据包直接就是IP包
+    if (netif->type == NETIF_TYPE_ETHER) {
+        if (buf->total_size < sizeof(ether_hdr_t)) {
+            return 0;
+        }
+
+        ether_hdr_t *ether_hdr = (ether_hdr_t *)pktbuf_peek(buf, 0, sizeof(ether_hdr_t), scratch);
+        if (x_ntohs(ether_hdr->protocol) != NET_PROTOCOL_IPv4) {
+            return 0;
+        }
+        offset = sizeof(ether_hdr_t);
+    }
+
+    if (buf->total_size < offset + 20) {
+        return 0;
+    }
+
+    uint8_t *ip_hdr = pktbuf_peek(buf, offset, 20, scratch);
+    if ((ip_hdr[0] >> 4) != 4) {
+        return 0;
+    }
+
+    int hdr_len = (ip_hdr[0] & 0xF) * 4;
+    int protocol = ip_hdr[9];
+    int frag = ((ip_hdr[6] << 8) | ip_hdr[7]) & 0x3FFF;     // 分片偏移及MF标志
+    plat_memcpy(tuple, ip_hdr + 12, 8);
+
+    int tuple_len = 8;
+    if (((protocol == NET_PROTOCOL_TCP) || (protocol == NET_PROTOCOL_UDP)) && !frag
+            && (buf->total_size >= offset + hdr_len + 4)) {
+        plat_memcpy(tuple + 8, pktbuf_peek(buf, offset + hdr_len, 4, scratch), 4);
+        tuple_len = 12;
+    }
+
+    return (int)(rss_toeplitz(tuple, tuple_len) % EXMSG_WORKER_CNT);
+#else
+    return 0;
+#endif
+}
+
 /**
  * @brief 将buf加入到网络接口的输入队列中
+ *        数据包按流哈希放入对应工作线程的输入队列，再通知该线程处理
  */
 net_err_t netif_put_in(netif_t *netif, pktbuf_t *buf, int tmo) {
+    int worker = netif_select_worker(netif, buf);
+
     // 写入接收队列
-    net_err_t err = fixq_send(&netif->in_q, buf, tmo);
+    net_err_t err = fixq_send(&netif->in_q[worker], buf, tmo);
     if (err < 0) {
-        dbg_warning(DBG_NETIF, "netif %s in_q full", netif->name);
+        dbg_warning(DBG_NETIF, "netif %s in_q %d full", netif->name, worker);
         return NET_ERR_FULL;
     }
 
-    // 通知消息处理线程，这里不处理消息是否发送成功等问题
+    // 通知消息处理线程，已有通知未处理时不会重复通知。这里不处理消息是否发送成功等问题
     // 消息满了不要紧，说明网卡正在忙，后续还会处理的
-    exmsg_netif_in(netif);
+    exmsg_netif_in(netif, worker);
     return NET_ERR_OK;
 }
 
+/**
+ * @brief 将一组数据包批量写入worker的输入队列，放不下的数据包被丢弃
+ * @return 写入的数据包数量
+ */
+static int netif_in_enqueue(netif_t *netif, int worker, pktbuf_t **bufs, int cnt) {
+    int n = fixq_send_many(&netif->in_q[worker], (void **)bufs, cnt, -1);
+    if (n < 0) {
+        n = 0;
+    }
+
+    if (n < cnt) {
+        dbg_warning(DBG_NETIF, "netif %s in_q %d full, drop %d", netif->name, worker, cnt - n);
+        for (int i = n; i < cnt; i++) {
+            pktbuf_free(bufs[i]);
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief 将驱动一次接收到的多个数据包加入输入队列
+ *        数据包先按工作线程分组，每组批量入队，最后每个工作线程只通知一次。
+ *        与netif_put_in不同，队列满时放不下的数据包直接被释放，调用者不再持有
+ * @return 成功加入的数据包数量
+ */
+int netif_put_in_batch(netif_t *netif, pktbuf_t **bufs, int cnt) {
+    pktbuf_t *group[EXMSG_WORKER_CNT][NETIF_IN_BATCH];
+    int group_cnt[EXMSG_WORKER_CNT] = {0};
+    int queued[EXMSG_WORKER_CNT] = {0};
+
+    for (int i = 0; i < cnt; i++) {
+        int worker = netif_select_worker(netif, bufs[i]);
+        group[worker][group_cnt[worker]++] = bufs[i];
+        if (group_cnt[worker] == NETIF_IN_BATCH) {
+            queued[worker] += netif_in_enqueue(netif, worker, group[worker], NETIF_IN_BATCH);
+            group_cnt[worker] = 0;
+        }
+    }
+
+    int total = 0;
+    for (int worker = 0; worker < EXMSG_WORKER_CNT; worker++) {
+        if (group_cnt[worker]) {
+            queued[worker] += netif_in_enqueue(netif, worker, group[worker], group_cnt[worker]);
+        }
+
+        if (queued[worker]) {
+            exmsg_netif_in(netif, worker);
+            total += queued[worker];
+        }
+    }
+
+    return total;
+}
+
 /**
  * @brief 将buf添加到网络接口的输出队列中
  */
@@ -353,11 +576,11 @@ net_err_t netif_put_out(netif_t *netif, pktbuf_t *buf, int tmo) {
 }
 
 /**
- * @brief 从输入队列中取出一个数据包
+ * @brief 从指定工作线程的输入队列中取出一个数据包
  */
-pktbuf_t* netif_get_in(netif_t *netif, int tmo) {
+pktbuf_t* netif_get_in(netif_t *netif, int worker, int tmo) {
     // 从接收队列中取数据包
-    pktbuf_t *buf = fixq_recv(&netif->in_q, tmo);
+    pktbuf_t *buf = fixq_recv(&netif->in_q[worker], tmo);
     if (buf) {
         // 重新定位，方便进行读写
         pktbuf_reset_acc(buf);
@@ -368,6 +591,20 @@ pktbuf_t* netif_get_in(netif_t *netif, int tmo) {
     return (pktbuf_t *)0;
 }
 
+/**
+ * @brief 从指定工作线程的输入队列中一次取出最多cnt个数据包
+ * @return 取出的数据包数量
+ */
+int netif_get_in_batch(netif_t *netif, int worker, pktbuf_t **bufs, int cnt, int tmo) {
+    int n = fixq_recv_many(&netif->in_q[worker], (void **)bufs, cnt, tmo);
+    for (int i = 0; i < n; i++) {
+        // 重新定位，方便进行读写
+        pktbuf_reset_acc(bufs[i]);
+    }
+
+    return n;
+}
+
 /**
  * @brief 从输出队列中取出一个数据包
  */
@@ -385,6 +622,21 @@ pktbuf_t* netif_get_in(netif_t *netif, int tmo) {
     return (pktbuf_t*)0;
 }
 
+/**
+ * @brief 从输出队列中一次取出最多cnt个数据包
+ *        供驱动线程轮询使用，队列为空时不输出调试信息
+ * @return 取出的数据包数量
+ */
+int netif_get_out_batch(netif_t *netif, pktbuf_t **bufs, int cnt, int tmo) {
+    int n = fixq_recv_many(&netif->out_q, (void **)bufs, cnt, tmo);
+    for (int i = 0; i < n; i++) {
+        // 重新定位，方便进行读写
+        pktbuf_reset_acc(bufs[i]);
+    }
+
+    return n;
+}
+
 /**
  * @brief 发送一个网络包到网络接口上, 目标地址为ipaddr
  * 
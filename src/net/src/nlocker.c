@@ -1,7 +1,30 @@
 #include "nlocker.h"
+#include "net_cfg.h"
 #include "net_err.h"
 #include "sys_plat.h"
 
+/**
+ * @brief 尝试获取自旋锁，先读再交换（TTAS），避免锁被占用时反复写缓存行
+ */
+static inline int spin_try_lock(nlocker_t *locker) {
+    return !__atomic_load_n(&locker->spin.locked, __ATOMIC_RELAXED)
+        && !__atomic_exchange_n(&locker->spin.locked, 1, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief 自旋最多cnt次尝试获取锁
+ * @return 1 获取成功，0 失败
+ */
+static int spin_lock_bounded(nlocker_t *locker, int cnt) {
+    for (int i = 0; i < cnt; i++) {
+        if (spin_try_lock(locker)) {
+            return 1;
+        }
+        sys_cpu_relax();
+    }
+    return 0;
+}
+
 /**
  * @brief 锁初始化
  */
@@ -13,6 +36,17 @@ net_err_t nlocker_init(nlocker_t *locker, nlocker_type_t type) {
             return NET_ERR_SYS;
         }
         locker->mutex = mutex;
+    } else if ((type == NLOCKER_SPIN) || (type == NLOCKER_ADAPTIVE)) {
+        locker->spin.locked = 0;
+        locker->spin.waiters = 0;
+        locker->spin.sem = SYS_SEM_INVALID;
+
+        if (type == NLOCKER_ADAPTIVE) {
+            locker->spin.sem = sys_sem_create(0);
+            if (locker->spin.sem == SYS_SEM_INVALID) {
+                return NET_ERR_SYS;
+            }
+        }
     }
 
     locker->type = type;
@@ -25,6 +59,8 @@ net_err_t nlocker_init(nlocker_t *locker, nlocker_type_t type) {
 void nlocker_destroy(nlocker_t *locker) {
     if (locker->type == NLOCKER_THREAD) {
         sys_mutex_free(locker->mutex);
+    } else if (locker->type == NLOCKER_ADAPTIVE) {
+        sys_sem_free(locker->spin.sem);
     }
 }
 
@@ -32,8 +68,30 @@ void nlocker_destroy(nlocker_t *locker) {
  * @brief 加锁
  */
 void nlocker_lock(nlocker_t *locker) {
-    if (locker->type == NLOCKER_THREAD) {
+    switch (locker->type) {
+    case NLOCKER_THREAD:
         sys_mutex_lock(locker->mutex);
+        break;
+    case NLOCKER_SPIN:
+        // 持有者可能被调度出去，自旋一轮仍未获得时让出cpu
+        while (!spin_lock_bounded(locker, NLOCKER_SPIN_CNT)) {
+            sys_thread_yield();
+        }
+        break;
+    case NLOCKER_ADAPTIVE:
+        if (spin_lock_bounded(locker, NLOCKER_SPIN_CNT)) {
+            break;
+        }
+
+        // 先登记为等待者再尝试，与解锁时先释放、再检查等待者配对，避免错过唤醒
+        __atomic_add_fetch(&locker->spin.waiters, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_exchange_n(&locker->spin.locked, 1, __ATOMIC_SEQ_CST)) {
+            sys_sem_wait(locker->spin.sem, 0);
+        }
+        __atomic_sub_fetch(&locker->spin.waiters, 1, __ATOMIC_RELAXED);
+        break;
+    default:
+        break;
     }
 }
 
@@ -41,7 +99,20 @@ void nlocker_lock(nlocker_t *locker) {
  * @brief 解锁
  */
 void nlocker_unlock(nlocker_t *locker) {
-    if (locker->type == NLOCKER_THREAD) {
+    switch (locker->type) {
+    case NLOCKER_THREAD:
         sys_mutex_unlock(locker->mutex);
+        break;
+    case NLOCKER_SPIN:
+        __atomic_store_n(&locker->spin.locked, 0, __ATOMIC_RELEASE);
+        break;
+    case NLOCKER_ADAPTIVE:
+        __atomic_store_n(&locker->spin.locked, 0, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&locker->spin.waiters, __ATOMIC_SEQ_CST) > 0) {
+            sys_sem_notify(locker->spin.sem);
+        }
+        break;
+    default:
+        break;
     }
-}
\ No newline at end of file
+}
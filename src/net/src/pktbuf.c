@@ -15,15 +15,244 @@
 #include "nlist.h"
 #include "nlocker.h"
 #include "sys_plat.h"
+#include "tools.h"
 #include <winnt.h>
 #include <winuser.h>
 
-static nlocker_t locker;
+static nlocker_t locker;                         // 扩充内存区时使用的锁
 
-static pktblk_t block_buffer[PKTBUF_BLK_CNT];
-static mblock_t block_list;                     // 空闲块列表
-static pktbuf_t pktbuf_buffer[PKTBUF_BUF_CNT];
-static mblock_t pktbuf_list;                    // 空闲包列表
+/**
+ * @brief 对象池：数据块池和数据包池
+ *        数据块按数据区大小分为多个池，分配时优先选择能容纳数据的最小块，
+ *        使大多数数据帧只需要一到两个块，减少块链的遍历和管理开销。
+ *        外部数据块只有块头，单独使用一个池
+ *
+ *        池的内存在初始化时按配置的数量从系统中整块映射（内存区，arena），大小足够时使用大页。
+ *        允许扩充时，所有内存区都用完后再映射一个同样大小的内存区，最多PKTBUF_ARENA_MAX个
+ */
+typedef struct _pktbuf_pool_t {
+    int blk_size;                       // 块数据区大小，数据包池为0
+    int obj_size;                       // 每个对象占用的空间
+    int cnt;                            // 每个内存区的对象数量
+    int grow;                           // 用完时是否扩充新的内存区
+    int mag_size;                       // 线程缓存中最多保留的对象数量
+    int arena_cnt;                      // 已映射的内存区数量
+    mblock_t list[PKTBUF_ARENA_MAX];    // 每个内存区的空闲对象列表
+}pktbuf_pool_t;
+
+#define PKTBLK_POOL_EXT     0           // 外部数据块池
+#define PKTBLK_POOL_SMALL   1           // 小块池，带数据区的池从这里开始，按大小升序排列
+#define PKTBLK_POOL_MID     2           // 中块池
+#define PKTBLK_POOL_BIG     3           // 大块池
+#define PKTBLK_POOL_CNT     4
+
+// 块头与数据区连续存放，对象大小按缓存行取整，使块头总是从缓存行起始处开始
+#define PKTBLK_OBJ_SIZE(size)   SYS_CACHE_ROUNDUP(sizeof(pktblk_t) + (size))
+
+// 布局检查：块头中逐次读写都会访问的字段位于第一个缓存行，数据包的读写位置不与数据块链共享缓存行
+dbg_static_assert(SYS_CACHE_LINE_OF(pktblk_t, base) == 0, pktblk_hot_line);
+dbg_static_assert(offsetof(pktblk_t, base) + sizeof(uint8_t *) <= SYS_CACHE_LINE_SIZE, pktblk_hot_fit);
+dbg_static_assert(sizeof(pktblk_t) <= 2 * SYS_CACHE_LINE_SIZE, pktblk_head_size);
+dbg_static_assert(SYS_CACHE_LINE_OF(pktbuf_t, pos) != SYS_CACHE_LINE_OF(pktbuf_t, ref), pktbuf_cursor_line);
+dbg_static_assert(SYS_CACHE_LINE_OF(pktbuf_t, blk_offset) == SYS_CACHE_LINE_OF(pktbuf_t, pos), pktbuf_cursor_fit);
+dbg_static_assert(sizeof(pktbuf_t) % SYS_CACHE_LINE_SIZE == 0, pktbuf_size);
+
+static pktbuf_pool_t blk_pools[PKTBLK_POOL_CNT];
+static pktbuf_pool_t buf_pool;                  // 数据包池
+
+/**
+ * @brief 为池映射一个新的内存区
+ *        映射的大小会按页向上取整，多出的空间也划分为对象
+ */
+static net_err_t pool_add_arena(pktbuf_pool_t *pool) {
+    size_t size = (size_t)pool->obj_size * pool->cnt;
+    uint8_t *mem = (uint8_t *)sys_mem_map(&size);
+    if (!mem) {
+        dbg_error(DBG_BUF, "map arena failed, size: %d", (int)size);
+        return NET_ERR_MEM;
+    }
+
+    int cnt = (int)(size / pool->obj_size);
+    net_err_t err = mblock_init(&pool->list[pool->arena_cnt], mem, pool->obj_size, cnt, PKTBUF_LOCKER);
+    if (err < 0) {
+        sys_mem_unmap(mem, size);
+        return err;
+    }
+
+    // 内存区初始化完成后才对分配者可见
+    sys_atomic_store(&pool->arena_cnt, pool->arena_cnt + 1);
+    dbg_info(DBG_BUF, "pool(%d) arena %d: %d objs", pool->blk_size, pool->arena_cnt, cnt);
+    return NET_ERR_OK;
+}
+
+/**
+ * @brief 初始化对象池，并映射第一个内存区
+ * @param blk_size 块数据区大小，为0时为外部数据块池或数据包池
+ */
+static net_err_t pool_init(pktbuf_pool_t *pool, int blk_size, int obj_size, int cnt, int grow) {
+    pool->blk_size = blk_size;
+    pool->obj_size = obj_size;
+    pool->cnt = cnt;
+    pool->grow = grow;
+    pool->arena_cnt = 0;
+
+    // 池较小时减少线程缓存的数量，避免大部分块滞留在某个线程中
+    pool->mag_size = cnt / 4 < PKTBUF_MAG_SIZE ? cnt / 4 : PKTBUF_MAG_SIZE;
+    if (pool->mag_size < 1) {
+        pool->mag_size = 1;
+    }
+
+    return cnt > 0 ? pool_add_arena(pool) : NET_ERR_OK;
+}
+
+/**
+ * @brief 从池中批量分配对象，不等待
+ *        依次从各内存区中分配，全部用完且允许扩充时，映射一个新的内存区
+ * @return 实际分配的数量
+ */
+static int pool_alloc_bulk(pktbuf_pool_t *pool, void **objs, int cnt) {
+    while (1) {
+        int arena_cnt = sys_atomic_load(&pool->arena_cnt);
+        int n = 0;
+        for (int i = 0; (i < arena_cnt) && (n < cnt); i++) {
+            n += mblock_alloc_bulk(&pool->list[i], objs + n, cnt - n);
+        }
+
+        if (n || !pool->grow || (pool->cnt <= 0) || (arena_cnt >= PKTBUF_ARENA_MAX)) {
+            return n;
+        }
+
+        // 其它线程可能已经扩充过，此时直接重试
+        nlocker_lock(&locker);
+        net_err_t err = NET_ERR_OK;
+        if (pool->arena_cnt == arena_cnt) {
+            err = pool_add_arena(pool);
+        }
+        nlocker_unlock(&locker);
+
+        if (err < 0) {
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief 将对象批量归还到池中，按所属的内存区分组归还
+ */
+static void pool_free_bulk(pktbuf_pool_t *pool, void **objs, int cnt) {
+    int arena_cnt = sys_atomic_load(&pool->arena_cnt);
+    for (int i = 0; (i < arena_cnt) && (cnt > 0); i++) {
+        mblock_t *list = &pool->list[i];
+
+        // 将属于该内存区的对象移到前面
+        int n = 0;
+        for (int k = 0; k < cnt; k++) {
+            if (mblock_owns(list, objs[k])) {
+                void *obj = objs[k];
+                objs[k] = objs[n];
+                objs[n++] = obj;
+            }
+        }
+
+        mblock_free_bulk(list, objs, n);
+        objs += n;
+        cnt -= n;
+    }
+
+    dbg_assert(cnt == 0, "free obj not in pool");
+}
+
+/**
+ * @brief 线程缓存（magazine）
+ *        每个线程各自缓存一组空闲的块/包，分配和释放优先在缓存中进行，无需加锁。
+ *        缓存为空时从全局空闲列表批量补充，缓存满时批量归还一半，
+ *        从而将对mblock锁和信号量的访问降低到每limit/2次操作一次
+ *
+ *        注意：缓存在线程中的对象对其它线程不可见，因此总的可用数量会略少于池的大小
+ */
+#if (PKTBUF_MAG_SIZE > 0) && defined(SYS_THREAD_LOCAL)
+
+typedef struct _pktbuf_mag_t {
+    int cnt;                            // 缓存中的对象数量
+    void *obj[PKTBUF_MAG_SIZE];         // 缓存的空闲对象
+}pktbuf_mag_t;
+
+static SYS_THREAD_LOCAL pktbuf_mag_t blk_mag[PKTBLK_POOL_CNT];   // 线程的空闲块缓存，每个块池一个
+static SYS_THREAD_LOCAL pktbuf_mag_t buf_mag;                     // 线程的空闲包缓存
+
+/**
+ * @brief 从线程缓存中分配对象，缓存为空时从池中批量补充
+ */
+static void *mag_alloc(pktbuf_mag_t *mag, pktbuf_pool_t *pool) {
+    if (mag->cnt == 0) {
+        mag->cnt = pool_alloc_bulk(pool, mag->obj, (pool->mag_size + 1) / 2);
+        if (mag->cnt == 0) {
+            return (void *)0;
+        }
+    }
+
+    return mag->obj[--mag->cnt];
+}
+
+/**
+ * @brief 批量分配对象，先取线程缓存中的对象，不足的部分直接从池中批量分配
+ * @return 实际分配的数量
+ */
+static int mag_alloc_bulk(pktbuf_mag_t *mag, pktbuf_pool_t *pool, void **objs, int cnt) {
+    int n = 0;
+    while ((n < cnt) && (mag->cnt > 0)) {
+        objs[n++] = mag->obj[--mag->cnt];
+    }
+
+    if (n < cnt) {
+        n += pool_alloc_bulk(pool, objs + n, cnt - n);
+    }
+    return n;
+}
+
+/**
+ * @brief 将对象释放到线程缓存中，缓存满时批量归还到池中
+ */
+static void mag_free(pktbuf_mag_t *mag, pktbuf_pool_t *pool, void *obj) {
+    if (mag->cnt >= pool->mag_size) {
+        int keep = pool->mag_size / 2;
+        pool_free_bulk(pool, mag->obj + keep, mag->cnt - keep);
+        mag->cnt = keep;
+    }
+
+    mag->obj[mag->cnt++] = obj;
+}
+
+#define pktblk_obj_alloc(pool)      mag_alloc(&blk_mag[pool], &blk_pools[pool])
+#define pktblk_obj_free(pool, blk)  mag_free(&blk_mag[pool], &blk_pools[pool], (blk))
+#define pktbuf_obj_alloc()          mag_alloc(&buf_mag, &buf_pool)
+#define pktbuf_obj_free(buf)        mag_free(&buf_mag, &buf_pool, (buf))
+#define pktblk_obj_alloc_bulk(pool, objs, cnt)  mag_alloc_bulk(&blk_mag[pool], &blk_pools[pool], (objs), (cnt))
+#define pktbuf_obj_alloc_bulk(objs, cnt)        mag_alloc_bulk(&buf_mag, &buf_pool, (objs), (cnt))
+#else
+/**
+ * @brief 不使用线程缓存时，直接在池中分配
+ */
+static void *list_alloc(pktbuf_pool_t *pool) {
+    // 不等待分配，因为会在中断中调用
+    void *obj;
+    return pool_alloc_bulk(pool, &obj, 1) ? obj : (void *)0;
+}
+
+/**
+ * @brief 不使用线程缓存时，直接释放到池中
+ */
+static void list_free(pktbuf_pool_t *pool, void *obj) {
+    pool_free_bulk(pool, &obj, 1);
+}
+
+#define pktblk_obj_alloc(pool)      list_alloc(&blk_pools[pool])
+#define pktblk_obj_free(pool, blk)  list_free(&blk_pools[pool], (blk))
+#define pktbuf_obj_alloc()          list_alloc(&buf_pool)
+#define pktbuf_obj_free(buf)        list_free(&buf_pool, (buf))
+#define pktblk_obj_alloc_bulk(pool, objs, cnt)  pool_alloc_bulk(&blk_pools[pool], (objs), (cnt))
+#define pktbuf_obj_alloc_bulk(objs, cnt)        pool_alloc_bulk(&buf_pool, (objs), (cnt))
+#endif
 
 /**
  * @brief 获取以当前位置而言，余下多少总共有效的数据空间
@@ -49,7 +278,15 @@ static int curr_blk_remain(pktbuf_t *buf) {
  */
 static inline int curr_blk_tail_free(pktblk_t *blk) {
     // 总大小 - （头部空闲空间） - （已用区域大小） = blk剩余空间大小
-    return PKTBUF_BLK_SIZE - (int)(blk->data - blk->payload) - blk->size;
+    return blk->capacity - (int)(blk->data - blk->base) - blk->size;
+}
+
+/**
+ * @brief 判断数据块的数据区是否与其它数据包共享
+ *        共享的数据区不能直接写入，也不能使用其头部和尾部的空闲空间
+ */
+static inline int pktblk_is_shared(pktblk_t *blk) {
+    return blk->owner || (blk->ref > 1);
 }
 
 /**
@@ -73,28 +310,28 @@ static void display_check_buf(pktbuf_t *buf) {
     for (curr = pktbuf_first_blk(buf); curr; curr = pktbuf_blk_next(curr)) {
         plat_printf("%d: ", index++);
 
-        if ((curr->data < curr->payload) || (curr->data >= curr->payload + PKTBUF_BLK_SIZE)) {
-            dbg_error(DBG_BUF, "bad block data. data=%p, payload=%p\n", curr->data, curr->payload);
+        if ((curr->data < curr->base) || (curr->data >= curr->base + curr->capacity)) {
+            dbg_error(DBG_BUF, "bad block data. data=%p, base=%p\n", curr->data, curr->base);
         }
 
 
-        // 开头可能存在的未用区域（从payload的起始地址到已用区域的起始地址）
-        int head_size = (int)(curr->data - curr->payload);
+        // 开头可能存在的未用区域（从数据区的起始地址到已用区域的起始地址）
+        int head_size = (int)(curr->data - curr->base);
         plat_printf("Head Free: %d b, ", head_size);
 
         // 中间存在的已用区域
         int used_size = curr->size;
         plat_printf("Used: %d b, ", used_size);
 
-        // 末尾可能存在的未用区域（从已用区域的末端地址到payload的末端地址）
+        // 末尾可能存在的未用区域（从已用区域的末端地址到数据区的末端地址）
         int tail_size = curr_blk_tail_free(curr);
         plat_printf("Tail Free: %d b, ", tail_size);
         plat_printf("\n");
 
-        // 检查当前计算所得的总和是否与PKTBUF_BLK_SIZE一致
+        // 检查当前计算所得的总和是否与数据区容量一致
         int blk_total = head_size + used_size + tail_size;
-        if (blk_total != PKTBUF_BLK_SIZE) {
-            dbg_error(DBG_BUF,"bad block size. %d != %d", blk_total, PKTBUF_BLK_SIZE);
+        if (blk_total != curr->capacity) {
+            dbg_error(DBG_BUF,"bad block size. %d != %d", blk_total, curr->capacity);
         }
 
         // 累计总的大小
@@ -110,12 +347,50 @@ static void display_check_buf(pktbuf_t *buf) {
 #define display_check_buf(buf)
 #endif
 
-net_err_t pktbuf_init(void) {
+/**
+ * @brief 初始化数据包管理
+ *        各池的大小由cfg指定，cfg为0时使用net_cfg.h中的配置
+ */
+net_err_t pktbuf_init(const pktbuf_cfg_t *cfg) {
+    static const pktbuf_cfg_t default_cfg = {
+        .ext_cnt = PKTBUF_EXT_CNT,
+        .blk_cnt = PKTBUF_BLK_CNT,
+        .mid_cnt = PKTBUF_BLK_MID_CNT,
+        .big_cnt = PKTBUF_BLK_BIG_CNT,
+        .buf_cnt = PKTBUF_BUF_CNT,
+        .grow = PKTBUF_GROW,
+    };
+
     dbg_info(DBG_BUF, "init pktbuf");
 
-    nlocker_init(&locker, NLOCKER_THREAD);
-    mblock_init(&block_list, block_buffer, sizeof(pktblk_t), PKTBUF_BLK_CNT, NLOCKER_THREAD);
-    mblock_init(&pktbuf_list, pktbuf_buffer, sizeof(pktbuf_t), PKTBUF_BUF_CNT, NLOCKER_THREAD);
+    if (!cfg) {
+        cfg = &default_cfg;
+    }
+
+    net_err_t err = nlocker_init(&locker, NLOCKER_THREAD);
+    if (err < 0) {
+        return err;
+    }
+
+    const struct {
+        pktbuf_pool_t *pool;
+        int blk_size;
+        int obj_size;
+        int cnt;
+    } pools[] = {
+        {&blk_pools[PKTBLK_POOL_EXT], 0, PKTBLK_OBJ_SIZE(0), cfg->ext_cnt},
+        {&blk_pools[PKTBLK_POOL_SMALL], PKTBUF_BLK_SIZE, PKTBLK_OBJ_SIZE(PKTBUF_BLK_SIZE), cfg->blk_cnt},
+        {&blk_pools[PKTBLK_POOL_MID], PKTBUF_BLK_MID_SIZE, PKTBLK_OBJ_SIZE(PKTBUF_BLK_MID_SIZE), cfg->mid_cnt},
+        {&blk_pools[PKTBLK_POOL_BIG], PKTBUF_BLK_BIG_SIZE, PKTBLK_OBJ_SIZE(PKTBUF_BLK_BIG_SIZE), cfg->big_cnt},
+        {&buf_pool, 0, sizeof(pktbuf_t), cfg->buf_cnt},
+    };
+    for (int i = 0; i < sizeof(pools) / sizeof(pools[0]); i++) {
+        err = pool_init(pools[i].pool, pools[i].blk_size, pools[i].obj_size, pools[i].cnt, cfg->grow);
+        if (err < 0) {
+            dbg_error(DBG_BUF, "pool init failed.");
+            return err;
+        }
+    }
 
     dbg_info(DBG_BUF, "init done");
 
@@ -123,18 +398,67 @@ net_err_t pktbuf_init(void) {
 }
 
 /**
- * @brief 在空闲块列表中分配一个空闲的数据块
+ * @brief 将当前线程缓存的空闲块和包全部归还到池中
+ *        会退出的线程（如关闭接口时的驱动线程）在退出前调用，否则缓存中的对象再也无法分配
  */
-static pktblk_t *pktblk_alloc(void) {
-    // 不等待分配，因为会在中断中调用
-    nlocker_lock(&locker);
-    pktblk_t* blk = mblock_alloc(&block_list, -1);
-    nlocker_unlock(&locker);
+void pktbuf_thread_exit(void) {
+#if (PKTBUF_MAG_SIZE > 0) && defined(SYS_THREAD_LOCAL)
+    for (int i = 0; i < PKTBLK_POOL_CNT; i++) {
+        pool_free_bulk(&blk_pools[i], blk_mag[i].obj, blk_mag[i].cnt);
+        blk_mag[i].cnt = 0;
+    }
+
+    pool_free_bulk(&buf_pool, buf_mag.obj, buf_mag.cnt);
+    buf_mag.cnt = 0;
+#endif
+}
+
+/**
+ * @brief 初始化刚从块池中分配的数据块
+ */
+static void pktblk_init(pktblk_t *blk, int pool) {
+    blk->size = 0;
+    blk->data = (uint8_t *)0;
+    blk->base = blk->payload;
+    blk->capacity = blk_pools[pool].blk_size;
+    blk->pool = pool;
+    blk->owner = (pktblk_t *)0;
+    blk->ref = 1;
+    blk->release = (pktblk_release_t)0;
+    blk->release_arg = (void *)0;
+    nlist_node_init(&blk->node);
+}
+
+/**
+ * @brief 在指定块池的空闲块列表中分配一个空闲的数据块
+ */
+static pktblk_t *pktblk_alloc_from(int pool) {
+    pktblk_t* blk = pktblk_obj_alloc(pool);
 
     if (blk) {
-        blk->size = 0;
-        blk->data = (uint8_t *)0;
-        nlist_node_init(&blk->node);
+        pktblk_init(blk, pool);
+    }
+
+    return blk;
+}
+
+/**
+ * @brief 分配一个空闲的数据块，优先选择能容纳size字节的最小块
+ *        该大小的块用完时，先尝试更大的块，再尝试更小的块
+ */
+static pktblk_t *pktblk_alloc(int size) {
+    // 找到能容纳size的最小块池，size超过最大块时使用最大块
+    int fit = PKTBLK_POOL_SMALL;
+    while ((fit < PKTBLK_POOL_CNT - 1) && (blk_pools[fit].blk_size < size)) {
+        fit++;
+    }
+
+    pktblk_t *blk = (pktblk_t *)0;
+    for (int pool = fit; !blk && (pool < PKTBLK_POOL_CNT); pool++) {
+        blk = pktblk_alloc_from(pool);
+    }
+    for (int pool = fit - 1; !blk && (pool >= PKTBLK_POOL_SMALL); pool--) {
+        blk = pktblk_alloc_from(pool);
     }
 
     return blk;
@@ -142,11 +466,26 @@ static pktblk_t *pktblk_alloc(void) {
 
 /**
  * @brief 释放数据块
+ *        数据区仍被其它块引用时只释放块头；否则释放整个块，
+ *        如果是外部数据块，先通过回调将数据区归还给其所有者
  */
 static void pktblk_free(pktblk_t *blk) {
-    nlocker_lock(&locker);
-    mblock_free(&block_list, blk);
-    nlocker_unlock(&locker);
+    // 克隆出的块头，释放后转为释放对所有者的引用
+    if (blk->owner) {
+        pktblk_t *owner = blk->owner;
+        pktblk_obj_free(blk->pool, blk);
+        blk = owner;
+    }
+
+    if (sys_atomic_dec(&blk->ref) > 0) {
+        return;
+    }
+
+    if (blk->release) {
+        blk->release(blk->release_arg, blk->base);
+    }
+
+    pktblk_obj_free(blk->pool, blk);
 }
 
 /**
@@ -179,15 +518,13 @@ static pktblk_t *pktblk_alloc_list(int size, int add_front) {
     pktblk_t *pre_blk = (pktblk_t *)0;  // 上一次分配的数据块
     
     while (size) {
-        // 新分配一个数据块
-        pktblk_t *new_blk = pktblk_alloc();
+        // 新分配一个数据块，块的大小根据剩余的数据量选择
+        pktblk_t *new_blk = pktblk_alloc(size);
         if (!new_blk) {
             dbg_error(DBG_BUF, "no buffer for alloc(%d)", size);
 
             // 释放建立当前block前已经创建的其他block
-            nlocker_lock(&locker);
             pktblk_free_list(first_blk);
-            nlocker_unlock(&locker);
             
             return (pktblk_t *)0;
         }
@@ -196,11 +533,11 @@ static pktblk_t *pktblk_alloc_list(int size, int add_front) {
         if (add_front) {
             // 头插法
             // 判断要分配的size是否大于单个数据块的大小
-            curr_size = size > PKTBUF_BLK_SIZE ? PKTBUF_BLK_SIZE : size;
+            curr_size = size > new_blk->capacity ? new_blk->capacity : size;
 
             // 反向分配，从末端往前分配空间
             new_blk->size = curr_size;
-            new_blk->data = new_blk->payload + PKTBUF_BLK_SIZE - curr_size;
+            new_blk->data = new_blk->base + new_blk->capacity - curr_size;
             // 调试信息
             // plat_printf("Allocated block: payload=%p, data=%p\n", new_blk->payload, new_blk->data);
             if (first_blk) {
@@ -216,11 +553,11 @@ static pktblk_t *pktblk_alloc_list(int size, int add_front) {
                 first_blk = new_blk;
             }
 
-            curr_size = size > PKTBUF_BLK_SIZE ? PKTBUF_BLK_SIZE : size;
+            curr_size = size > new_blk->capacity ? new_blk->capacity : size;
 
             // 正向分配，从前端向末端分配空间
             new_blk->size = curr_size;
-            new_blk->data = new_blk->payload;  // 尾插法从payload开始的位置开始放数据
+            new_blk->data = new_blk->base;  // 尾插法从数据区开始的位置开始放数据
             if (pre_blk) {
                 // 设置pre_blk和new_blk的连接关系
                 nlist_node_set_next(&pre_blk->node, &new_blk->node);
@@ -279,9 +616,7 @@ static void pktbuf_insert_blk_list(pktbuf_t *buf, pktblk_t *first_blk, int add_f
  */
 pktbuf_t *pktbuf_alloc(int size) {
     // 分配一个数据包
-    nlocker_lock(&locker);
-    pktbuf_t* buf = mblock_alloc(&pktbuf_list, -1);
-    nlocker_unlock(&locker);
+    pktbuf_t* buf = pktbuf_obj_alloc();
     if (!buf) {
         dbg_error(DBG_BUF, "no buffer");
         return (pktbuf_t *)0;
@@ -295,9 +630,7 @@ pktbuf_t *pktbuf_alloc(int size) {
     if (size) {
         pktblk_t *blk = pktblk_alloc_list(size, 1);
         if (!blk) {
-            nlocker_lock(&locker);
-            mblock_free(&pktbuf_list, buf);
-            nlocker_unlock(&locker);
+            pktbuf_obj_free(buf);
             return (pktbuf_t *)0;
         } 
 
@@ -309,16 +642,248 @@ pktbuf_t *pktbuf_alloc(int size) {
     return buf;
 }
 
+/**
+ * @brief 分配数据包，并保证第一个数据块的数据前至少有headroom字节的空闲空间
+ *
+ *        用于发送路径：之后各层通过pktbuf_add_header添加不超过headroom字节的包头时，
+ *        只需移动数据指针，不会再分配新的数据块
+ */
+pktbuf_t *pktbuf_alloc_reserve(int size, int headroom) {
+    if ((headroom < 0) || (headroom >= PKTBUF_BLK_BIG_SIZE)) {
+        dbg_error(DBG_BUF, "headroom too big: %d", headroom);
+        return (pktbuf_t *)0;
+    }
+
+    pktbuf_t *buf = pktbuf_alloc(0);
+    if (!buf) {
+        return (pktbuf_t *)0;
+    }
+
+    // 第一个块：按size + headroom选择块大小，数据放在块的末端，前面的空间全部作为头部空间
+    pktblk_t *blk = pktblk_alloc(size + headroom);
+    if (!blk || (blk->capacity <= headroom)) {
+        dbg_error(DBG_BUF, "no buffer for alloc(%d + %d)", size, headroom);
+        if (blk) {
+            pktblk_free(blk);
+        }
+        pktbuf_free(buf);
+        return (pktbuf_t *)0;
+    }
+
+    int first_size = size > blk->capacity - headroom ? blk->capacity - headroom : size;
+    blk->size = first_size;
+    blk->data = blk->base + blk->capacity - first_size;
+    pktbuf_insert_blk_list(buf, blk, 0);
+
+    // 第一个块放不下的数据，依次放在后续块中
+    if (size > first_size) {
+        blk = pktblk_alloc_list(size - first_size, 0);
+        if (!blk) {
+            pktbuf_free(buf);
+            return (pktbuf_t *)0;
+        }
+        pktbuf_insert_blk_list(buf, blk, 0);
+    }
+
+    pktbuf_reset_acc(buf);
+    display_check_buf(buf);
+    return buf;
+}
+
+/**
+ * @brief 分配一个引用外部数据的数据包，数据不会被复制
+ *
+ *        数据包只有一个数据块，该块的数据区直接指向data。当数据包最终被释放时，
+ *        调用release(arg, data)将数据区归还给其所有者。分配失败时不会调用release，
+ *        数据区仍由调用者负责
+ */
+pktbuf_t *pktbuf_alloc_ext(uint8_t *data, int size, pktblk_release_t release, void *arg) {
+    pktbuf_t *buf = pktbuf_alloc(0);
+    if (!buf) {
+        return (pktbuf_t *)0;
+    }
+
+    pktblk_t *blk = pktblk_alloc_from(PKTBLK_POOL_EXT);
+    if (!blk) {
+        dbg_error(DBG_BUF, "no block for ext data");
+        pktbuf_free(buf);
+        return (pktbuf_t *)0;
+    }
+
+    blk->base = data;
+    blk->capacity = size;
+    blk->data = data;
+    blk->size = size;
+    blk->release = release;
+    blk->release_arg = arg;
+    pktbuf_insert_blk_list(buf, blk, 0);
+
+    pktbuf_reset_acc(buf);
+    display_check_buf(buf);
+    return buf;
+}
+
+/**
+ * @brief 批量分配引用外部数据的数据包，用于驱动一次接收多个数据帧
+ *
+ *        第i个数据包引用data[i]开始的size[i]字节，释放时调用release(arg[i], data[i])。
+ *        包和数据块都是整批从线程缓存或池中取出的，不必逐个分配。
+ *        数据包按顺序分配，分配失败的部分不会调用release，其数据区仍由调用者负责
+ * @return 实际分配的数量
+ */
+int pktbuf_alloc_ext_bulk(pktbuf_t **bufs, uint8_t **data, const int *size, int cnt,
+                          pktblk_release_t release, void **arg) {
+    int buf_cnt = pktbuf_obj_alloc_bulk((void **)bufs, cnt);
+
+    // 块头按批取出，每批的数量受限于栈上的临时数组
+    int done = 0;
+    while (done < buf_cnt) {
+        pktblk_t *blks[PKTBUF_BULK_SIZE];
+        int want = buf_cnt - done < PKTBUF_BULK_SIZE ? buf_cnt - done : PKTBUF_BULK_SIZE;
+        int got = pktblk_obj_alloc_bulk(PKTBLK_POOL_EXT, (void **)blks, want);
+
+        for (int i = 0; i < got; i++) {
+            pktbuf_t *buf = bufs[done + i];
+            buf->ref = 1;
+            buf->total_size = 0;
+            nlist_init(&buf->blk_list);
+            nlist_node_init(&buf->node);
+
+            pktblk_t *blk = blks[i];
+            pktblk_init(blk, PKTBLK_POOL_EXT);
+            blk->base = data[done + i];
+            blk->capacity = size[done + i];
+            blk->data = blk->base;
+            blk->size = size[done + i];
+            blk->release = release;
+            blk->release_arg = arg[done + i];
+            pktbuf_insert_blk_list(buf, blk, 0);
+
+            pktbuf_reset_acc(buf);
+            display_check_buf(buf);
+        }
+
+        done += got;
+        if (got < want) {
+            dbg_error(DBG_BUF, "no block for ext data");
+            break;
+        }
+    }
+
+    // 块头不足时，归还多分配的数据包
+    for (int i = done; i < buf_cnt; i++) {
+        pktbuf_obj_free(bufs[i]);
+    }
+    if (buf_cnt < cnt) {
+        dbg_error(DBG_BUF, "no buffer");
+    }
+
+    return done;
+}
+
+/**
+ * @brief 克隆数据包，新数据包与原数据包共享数据区，数据不复制
+ *
+ *        克隆只为每个数据块分配块头，块头引用原数据块的数据区。此后任意一方
+ *        写入共享的数据块时会先复制一份（写时复制）；添加包头时总是使用新的数据块，
+ *        因此各个克隆可以有各自不同的包头。适用于广播、镜像和重传队列等场合
+ */
+pktbuf_t *pktbuf_clone(pktbuf_t *buf) {
+    dbg_assert(buf->ref != 0, "buf freed");
+
+    pktbuf_t *new_buf = pktbuf_alloc(0);
+    if (!new_buf) {
+        return (pktbuf_t *)0;
+    }
+
+    for (pktblk_t *blk = pktbuf_first_blk(buf); blk; blk = pktbuf_blk_next(blk)) {
+        pktblk_t *clone = pktblk_alloc_from(PKTBLK_POOL_EXT);
+        if (!clone) {
+            dbg_error(DBG_BUF, "no block for clone");
+            pktbuf_free(new_buf);
+            return (pktbuf_t *)0;
+        }
+
+        // 总是引用真正的所有者，避免形成引用链
+        pktblk_t *owner = blk->owner ? blk->owner : blk;
+        sys_atomic_inc(&owner->ref);
+
+        clone->owner = owner;
+        clone->base = blk->base;
+        clone->capacity = blk->capacity;
+        clone->data = blk->data;
+        clone->size = blk->size;
+        nlist_insert_last(&new_buf->blk_list, &clone->node);
+        new_buf->total_size += clone->size;
+    }
+
+    pktbuf_reset_acc(new_buf);
+    display_check_buf(new_buf);
+    return new_buf;
+}
+
+/**
+ * @brief 将共享的数据块复制为数据包私有的数据块，并替换原来的块（写时复制）
+ *        尽量保留原有的头部空闲空间
+ *
+ * @return 替换后的数据块，失败时返回0，原数据块保持不变
+ */
+static pktblk_t *pktblk_unshare(pktbuf_t *buf, pktblk_t *blk) {
+    int head_size = (int)(blk->data - blk->base);
+
+    pktblk_t *new_blk = pktblk_alloc(head_size + blk->size);
+    if (!new_blk) {
+        dbg_error(DBG_BUF, "no block for unshare");
+        return (pktblk_t *)0;
+    }
+
+    if (new_blk->capacity < blk->size) {
+        dbg_error(DBG_BUF, "no block big enough for unshare (size %d)", blk->size);
+        pktblk_free(new_blk);
+        return (pktblk_t *)0;
+    }
+
+    if (new_blk->capacity < head_size + blk->size) {
+        head_size = new_blk->capacity - blk->size;
+    }
+    new_blk->data = new_blk->base + head_size;
+    new_blk->size = blk->size;
+    plat_memcpy(new_blk->data, blk->data, blk->size);
+
+    nlist_insert_after(&buf->blk_list, &blk->node, &new_blk->node);
+    nlist_remove(&buf->blk_list, &blk->node);
+    pktblk_free(blk);
+    return new_blk;
+}
+
+/**
+ * @brief 保证当前读写位置所在的数据块可写，共享的块先复制一份
+ */
+static net_err_t curr_blk_writable(pktbuf_t *buf) {
+    pktblk_t *blk = buf->curr_blk;
+    if (!blk || !pktblk_is_shared(blk)) {
+        return NET_ERR_OK;
+    }
+
+    int offset = (int)(buf->blk_offset - blk->data);
+    pktblk_t *new_blk = pktblk_unshare(buf, blk);
+    if (!new_blk) {
+        return NET_ERR_MEM;
+    }
+
+    buf->curr_blk = new_blk;
+    buf->blk_offset = new_blk->data + offset;
+    return NET_ERR_OK;
+}
+
 /**
  * @brief 释放数据包
  */
 void pktbuf_free(pktbuf_t *buf) {
-    nlocker_lock(&locker);
-    if (--buf->ref == 0) {
+    if (sys_atomic_dec(&buf->ref) == 0) {
         pktblk_free_list(pktbuf_first_blk(buf));
-        mblock_free(&pktbuf_list, buf);
+        pktbuf_obj_free(buf);
     }
-    nlocker_unlock(&locker);
 }
 
 /**
@@ -331,8 +896,8 @@ net_err_t pktbuf_add_header(pktbuf_t *buf, int size, int cont) {
 
     pktblk_t *blk = pktbuf_first_blk(buf);
 
-    // 当前数据块链的第一个数据块可以存放空余数据的空间
-    int recv_size = (int)(blk->data - blk->payload);
+    // 当前数据块链的第一个数据块可以存放空余数据的空间，共享的数据块不能使用
+    int recv_size = pktblk_is_shared(blk) ? 0 : (int)(blk->data - blk->base);
 
     // 头部有足够的空间可以放包头
     if (size <= recv_size) {
@@ -348,21 +913,30 @@ net_err_t pktbuf_add_header(pktbuf_t *buf, int size, int cont) {
     if (cont) {
         // 分配连续包头
 
-        // 包头数据长度超过数据块长度，无法分配
-        if (size > PKTBUF_BLK_SIZE) {
-            dbg_error(DBG_BUF, "set cont, size too big: %d > %d", size, PKTBUF_BLK_SIZE);
+        // 包头数据长度超过最大的数据块长度，无法分配
+        if (size > PKTBUF_BLK_BIG_SIZE) {
+            dbg_error(DBG_BUF, "set cont, size too big: %d > %d", size, PKTBUF_BLK_BIG_SIZE);
             return NET_ERR_SIZE;
         }
 
-        // 分配一个新的数据块用于放包头数据
-        blk = pktblk_alloc_list(size, 1);
+        // 分配一个新的数据块用于放包头数据，必须能一次放下整个包头
+        blk = pktblk_alloc(size);
         if (!blk) {
             dbg_error(DBG_BUF, "no buffer (size %d)", size);
             return NET_ERR_NONE;
         }
+
+        if (blk->capacity < size) {
+            dbg_error(DBG_BUF, "no block big enough (size %d)", size);
+            pktblk_free(blk);
+            return NET_ERR_NONE;
+        }
+
+        blk->size = size;
+        blk->data = blk->base + blk->capacity - size;
     } else {
         // 分配非连续包头
-        blk->data = blk->payload;
+        blk->data -= recv_size;
         blk->size += recv_size;
         buf->total_size += recv_size;
         size -= recv_size;
@@ -445,7 +1019,7 @@ net_err_t pktbuf_resize(pktbuf_t *buf, int to_size) {
         pktblk_t *tail_blk = pktbuf_last_blk(buf);
         // 判断数据块链的尾部数据块，其剩余空间大小是否可以放下需要扩充的那部分大小
         int inc_size = to_size - buf->total_size;
-        int remain_size = curr_blk_tail_free(tail_blk);
+        int remain_size = pktblk_is_shared(tail_blk) ? 0 : curr_blk_tail_free(tail_blk);
         if (inc_size <= remain_size) {
             // 能放下
             tail_blk->size += inc_size;
@@ -541,12 +1115,6 @@ net_err_t pktbuf_set_cont(pktbuf_t *buf, int size) {
         return NET_ERR_SIZE;
     }
 
-    // 超过1个POOL的大小，返回错误
-    if (size > PKTBUF_BLK_SIZE) {
-        dbg_error(DBG_BUF,"size too big > %d", PKTBUF_BLK_SIZE);
-        return NET_ERR_SIZE;
-    }
-
     // 包头已经处于连续空间，不用处理
     pktblk_t * first_blk = pktbuf_first_blk(buf);
     if (size <= first_blk->size) {
@@ -554,18 +1122,37 @@ net_err_t pktbuf_set_cont(pktbuf_t *buf, int size) {
         return NET_ERR_OK;
     }
 
+    // 超过第一个块数据区的大小，返回错误
+    if (size > first_blk->capacity) {
+        dbg_error(DBG_BUF,"size too big > %d", first_blk->capacity);
+        return NET_ERR_SIZE;
+    }
+
+    // 需要写入第一个块，共享的块先复制一份
+    if (pktblk_is_shared(first_blk)) {
+        first_blk = pktblk_unshare(buf, first_blk);
+        if (!first_blk) {
+            return NET_ERR_MEM;
+        }
+
+        if (size > first_blk->capacity) {
+            dbg_error(DBG_BUF,"size too big > %d", first_blk->capacity);
+            return NET_ERR_SIZE;
+        }
+    }
+
     // 先将第一个blk中的数据挪动到起始处，以在尾部腾出size空间
 #if 0
-    uint8_t * dest = first_blk->payload + PKTBUF_BLK_SIZE - size;
+    uint8_t * dest = first_blk->base + first_blk->capacity - size;
     plat_memmove(dest, first_blk->data, first_blk->size);   // 注意处理内存重叠
     first_blk->data = dest;
     dest += first_blk->size;          // 指向下一块复制的目的地
 #else
-    uint8_t * dest = first_blk->payload;
+    uint8_t * dest = first_blk->base;
     for (int i=0; i < first_blk->size; i++) {
         *dest++ = first_blk->data[i];
     }
-    first_blk->data = first_blk->payload;
+    first_blk->data = first_blk->base;
 #endif
 
     // 再依次将后续的空间挪动到buf中，直到buf中的大小达到size
@@ -652,6 +1239,12 @@ net_err_t pktbuf_write(pktbuf_t *buf, uint8_t *src, int size) {
     }
 
     while (size) {
+        // 共享的数据块需要先复制一份再写入
+        net_err_t err = curr_blk_writable(buf);
+        if (err < 0) {
+            return err;
+        }
+
         // 获取当前blk可写入的数据大小
         int blk_size = curr_blk_remain(buf);
         // 和size比较，更新当前实际可写入的大小
@@ -764,6 +1357,11 @@ net_err_t pktbuf_copy(pktbuf_t *dest, pktbuf_t *src, int size) {
 
     // 进行实际的拷贝工作
     while (size) {
+        net_err_t err = curr_blk_writable(dest);
+        if (err < 0) {
+            return err;
+        }
+
         // 在size、以及buf中当前块剩余大小三者中取最小的值
         int dest_remain = curr_blk_remain(dest);
         int src_remain = curr_blk_remain(src);
@@ -801,6 +1399,11 @@ net_err_t pktbuf_fill(pktbuf_t *buf, uint8_t v, int size) {
 
     // 循环写入所有数据
     while (size > 0) {
+        net_err_t err = curr_blk_writable(buf);
+        if (err < 0) {
+            return err;
+        }
+
         int blk_size = curr_blk_remain(buf);
 
         // 判断当前写入的量
@@ -820,7 +1423,125 @@ net_err_t pktbuf_fill(pktbuf_t *buf, uint8_t v, int size) {
  * @param buf
  */
 void pktbuf_inc_ref (pktbuf_t *buf) {
-    nlocker_lock(&locker);
-    buf->ref++;
-    nlocker_unlock(&locker);
-}
\ No newline at end of file
+    sys_atomic_inc(&buf->ref);
+}
+
+/**
+ * @brief 计算数据包中从offset开始、长度为len的数据的校验和
+ *        逐块计算累加和，块的长度为奇数时，后续块的累加和会自动调整高低字节。
+ *        不使用也不改变数据包当前的读写位置
+ *
+ * @param seed 预先计算的累加和，如伪首部的累加和，没有时为0
+ * @return 取反后的校验和，可直接填入包头；对包含校验和字段的数据计算时，结果为0表示校验正确
+ */
+uint16_t pktbuf_checksum16(pktbuf_t *buf, int offset, int len, uint32_t seed) {
+    dbg_assert(buf->ref != 0, "buf freed");
+
+    if ((offset < 0) || (len < 0) || (offset + len > buf->total_size)) {
+        dbg_error(DBG_BUF, "size error: %d + %d > %d", offset, len, buf->total_size);
+        return 0;
+    }
+
+    // 定位到offset所在的数据块
+    pktblk_t *blk = pktbuf_first_blk(buf);
+    while (blk && (offset >= blk->size)) {
+        offset -= blk->size;
+        blk = pktbuf_blk_next(blk);
+    }
+
+    uint32_t sum = seed;
+    uint32_t done = 0;
+    while (len > 0) {
+        int curr_size = blk->size - offset;
+        curr_size = curr_size > len ? len : curr_size;
+
+        sum = checksum16(done, blk->data + offset, curr_size, sum, 0);
+
+        done += curr_size;
+        len -= curr_size;
+        offset = 0;
+        blk = pktbuf_blk_next(blk);
+    }
+
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief 取数据包中从offset开始、长度为len的一段连续数据
+ *        数据位于同一个数据块内时，直接返回块内的指针，不复制；跨越多个块时，
+ *        将数据依次复制到scratch中并返回scratch。不使用也不改变数据包当前的读写位置
+ *
+ *        返回的指针只用于读，数据块可能与克隆的数据包共享；修改数据请使用pktbuf_write
+ *
+ * @param scratch 调用者提供的缓存，至少len字节；为0时，跨块的数据返回失败
+ * @return 数据的起始地址，失败时返回0
+ */
+uint8_t *pktbuf_peek(pktbuf_t *buf, int offset, int len, uint8_t *scratch) {
+    dbg_assert(buf->ref != 0, "buf freed");
+
+    if ((offset < 0) || (len <= 0) || (offset + len > buf->total_size)) {
+        dbg_error(DBG_BUF, "size error: %d + %d > %d", offset, len, buf->total_size);
+        return (uint8_t *)0;
+    }
+
+    // 定位到offset所在的数据块
+    pktblk_t *blk = pktbuf_first_blk(buf);
+    while (blk && (offset >= blk->size)) {
+        offset -= blk->size;
+        blk = pktbuf_blk_next(blk);
+    }
+
+    // 整段数据在当前块内，直接返回
+    if (offset + len <= blk->size) {
+        return blk->data + offset;
+    }
+
+    if (!scratch) {
+        return (uint8_t *)0;
+    }
+
+    // 跨块，逐块复制到scratch中
+    uint8_t *dest = scratch;
+    while (len > 0) {
+        int curr_size = blk->size - offset;
+        curr_size = curr_size > len ? len : curr_size;
+
+        plat_memcpy(dest, blk->data + offset, curr_size);
+
+        dest += curr_size;
+        len -= curr_size;
+        offset = 0;
+        blk = pktbuf_blk_next(blk);
+    }
+
+    return scratch;
+}
+
+/**
+ * @brief 将数据包的数据块链导出为iovec数组，每个非空数据块对应一项，数据不复制
+ *        用于支持分散/聚集发送的驱动（如writev/sendmsg）直接发送整个数据块链。
+ *        导出的iovec在数据包释放前有效，且只能用于读
+ *
+ * @param iov_cnt iov数组的容量
+ * @return 实际使用的项数；数据块过多放不下时返回NET_ERR_SIZE
+ */
+int pktbuf_to_iovec(pktbuf_t *buf, struct iovec *iov, int iov_cnt) {
+    dbg_assert(buf->ref != 0, "buf freed");
+
+    int cnt = 0;
+    for (pktblk_t *blk = pktbuf_first_blk(buf); blk; blk = pktbuf_blk_next(blk)) {
+        if (blk->size == 0) {
+            continue;
+        }
+
+        if (cnt >= iov_cnt) {
+            return NET_ERR_SIZE;
+        }
+
+        iov[cnt].iov_base = blk->data;
+        iov[cnt].iov_len = blk->size;
+        cnt++;
+    }
+
+    return cnt;
+}
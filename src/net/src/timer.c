@@ -0,0 +1,244 @@
+/**
+ * @file timer.c
+ * @brief 协议栈定时器
+ *
+ * 每个工作线程有一个分层时间轮，定时器只能在工作线程中添加、删除，回调也在该线程中执行，
+ * 因此无需加锁。添加时按剩余时间直接定位到某层的某个槽，删除时从所在的双向链表中摘除，
+ * 都是O(1)的。时间每前进1ms处理第0层的一个槽；第0层转完一圈时，将第1层对应槽中的定时器
+ * 重新分配到第0层，依此类推
+ */
+
+#include "timer.h"
+#include "dbg.h"
+#include "nlist.h"
+#include "sys_plat.h"
+
+static SYS_THREAD_LOCAL net_timer_wheel_t *curr_wheel;      // 当前线程拥有的时间轮
+
+#define LEVEL_SHIFT(level)      ((level) * NET_TIMER_WHEEL_BITS)
+#define LEVEL_SPAN(level)       ((uint32_t)1 << LEVEL_SHIFT((level) + 1))   // 该层及以下能表示的最长时间
+#define MAX_TMO                 (LEVEL_SPAN(NET_TIMER_WHEEL_LEVELS - 1) - 1)
+
+/**
+ * @brief 初始化时间轮
+ */
+void net_timer_wheel_init(net_timer_wheel_t *wheel) {
+    wheel->jiffies = 0;
+    wheel->now = 0;
+    sys_time_curr(&wheel->last);
+
+    for (int level = 0; level < NET_TIMER_WHEEL_LEVELS; level++) {
+        wheel->cnt[level] = 0;
+        for (int i = 0; i < NET_TIMER_SLOTS; i++) {
+            nlist_init(&wheel->slots[level][i]);
+        }
+    }
+}
+
+/**
+ * @brief 将时间轮绑定到当前线程，此后该线程中添加的定时器都放入这个时间轮
+ */
+void net_timer_wheel_bind(net_timer_wheel_t *wheel) {
+    curr_wheel = wheel;
+}
+
+/**
+ * @brief 按剩余时间将定时器放入合适的层和槽
+ *        已到期的定时器放入第0层下一个待处理的槽，超出最长时间的放入最高层，到时重新分配
+ */
+static void wheel_insert(net_timer_wheel_t *wheel, net_timer_t *timer) {
+    int32_t diff = (int32_t)(timer->expire - wheel->now);
+    uint32_t expire = timer->expire;
+    int level = 0;
+
+    if (diff < 0) {
+        expire = wheel->now;
+    } else if ((uint32_t)diff > MAX_TMO) {
+        expire = wheel->now + MAX_TMO;
+        level = NET_TIMER_WHEEL_LEVELS - 1;
+    } else {
+        while ((uint32_t)diff >= LEVEL_SPAN(level)) {
+            level++;
+        }
+    }
+
+    int idx = (expire >> LEVEL_SHIFT(level)) & NET_TIMER_SLOT_MASK;
+    timer->slot = &wheel->slots[level][idx];
+    timer->level = level;
+    nlist_insert_last(timer->slot, &timer->node);
+    wheel->cnt[level]++;
+}
+
+/**
+ * @brief 将槽中的所有定时器取出到list中，此后定时器不再计入所在层
+ */
+static void wheel_detach(net_timer_wheel_t *wheel, int level, int idx, nlist_t *list) {
+    nlist_t *slot = &wheel->slots[level][idx];
+
+    nlist_init(list);
+    nlist_node_t *node;
+    while ((node = nlist_remove_first(slot)) != (nlist_node_t *)0) {
+        net_timer_t *timer = nlist_entry(node, net_timer_t, node);
+        timer->slot = list;
+        timer->level = -1;
+        nlist_insert_last(list, node);
+    }
+    wheel->cnt[level] -= list->count;
+}
+
+/**
+ * @brief 将高层某个槽中的定时器重新分配到低层
+ */
+static void wheel_cascade(net_timer_wheel_t *wheel, int level, int idx) {
+    nlist_t list;
+    wheel_detach(wheel, level, idx, &list);
+
+    nlist_node_t *node;
+    while ((node = nlist_remove_first(&list)) != (nlist_node_t *)0) {
+        wheel_insert(wheel, nlist_entry(node, net_timer_t, node));
+    }
+}
+
+static int wheel_empty(net_timer_wheel_t *wheel) {
+    for (int level = 0; level < NET_TIMER_WHEEL_LEVELS; level++) {
+        if (wheel->cnt[level]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief 添加定时器，只能在拥有时间轮的工作线程中调用
+ * @param ms 定时时间，周期性定时器同时也是周期
+ * @param flags NET_TIMER_RELOAD等标志
+ */
+net_err_t net_timer_add(net_timer_t *timer, const char *name, timer_proc_t proc, void *arg, int ms, int flags) {
+    net_timer_wheel_t *wheel = curr_wheel;
+    if (!wheel) {
+        dbg_error(DBG_TIMER, "timer %s: no timer wheel in this thread", name);
+        return NET_ERR_STATE;
+    }
+
+    if ((ms < 0) || ((flags & NET_TIMER_RELOAD) && (ms == 0))) {
+        dbg_error(DBG_TIMER, "timer %s: tmo error: %d", name, ms);
+        return NET_ERR_PARAM;
+    }
+
+    dbg_info(DBG_TIMER, "insert timer: %s", name);
+
+    // 时间轮为空时工作线程可能已阻塞了很长时间，jiffies未更新，需先追上当前时间，
+    // 否则到期时刻会落在过去而立即到期。为空时也无需再逐个处理已过去的时间
+    wheel->jiffies += sys_time_goes(&wheel->last);
+    if (wheel_empty(wheel)) {
+        wheel->now = wheel->jiffies;
+    }
+
+    plat_strncpy(timer->name, name, TIMER_NAME_SIZE);
+    timer->name[TIMER_NAME_SIZE - 1] = '\0';
+    timer->flags = flags;
+    timer->reload = ms;
+    timer->proc = proc;
+    timer->arg = arg;
+    timer->wheel = wheel;
+    timer->expire = wheel->jiffies + ms;
+    nlist_node_init(&timer->node);
+
+    wheel_insert(wheel, timer);
+    return NET_ERR_OK;
+}
+
+/**
+ * @brief 删除定时器，定时器未运行时不做任何处理
+ *        可以在定时器回调中删除任意定时器，包括自身
+ */
+void net_timer_remove(net_timer_t *timer) {
+    if (!timer->slot) {
+        return;
+    }
+
+    dbg_info(DBG_TIMER, "remove timer: %s", timer->name);
+
+    nlist_remove(timer->slot, &timer->node);
+    if (timer->level >= 0) {
+        timer->wheel->cnt[timer->level]--;
+    }
+    timer->slot = (nlist_t *)0;
+}
+
+/**
+ * @brief 更新时间，并执行所有到期的定时器
+ *        由工作线程定期调用
+ * @return 执行的定时器数量
+ */
+int net_timer_check_tmo(net_timer_wheel_t *wheel) {
+    int cnt = 0;
+
+    wheel->jiffies += sys_time_goes(&wheel->last);
+    while ((int32_t)(wheel->jiffies - wheel->now) >= 0) {
+        // 没有定时器时无需逐个处理
+        if (wheel_empty(wheel)) {
+            wheel->now = wheel->jiffies + 1;
+            break;
+        }
+
+        // 低层转完一圈，将高层对应槽中的定时器重新分配
+        int idx = wheel->now & NET_TIMER_SLOT_MASK;
+        if (idx == 0) {
+            for (int level = 1; level < NET_TIMER_WHEEL_LEVELS; level++) {
+                int level_idx = (wheel->now >> LEVEL_SHIFT(level)) & NET_TIMER_SLOT_MASK;
+                wheel_cascade(wheel, level, level_idx);
+                if (level_idx) {
+                    break;
+                }
+            }
+        }
+
+        // 先取出到期的定时器再前进，回调中新加入的定时器不会放入正在处理的槽中
+        nlist_t list;
+        wheel_detach(wheel, 0, idx, &list);
+        wheel->now++;
+
+        nlist_node_t *node;
+        while ((node = nlist_remove_first(&list)) != (nlist_node_t *)0) {
+            net_timer_t *timer = nlist_entry(node, net_timer_t, node);
+            timer->slot = (nlist_t *)0;
+
+            // 周期性定时器在回调前重新加入，以便回调中可以将其删除
+            if (timer->flags & NET_TIMER_RELOAD) {
+                timer->expire += timer->reload;
+                wheel_insert(wheel, timer);
+            }
+
+            dbg_info(DBG_TIMER, "timer %s timeout", timer->name);
+            timer->proc(timer, timer->arg);
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief 距离下一次需要调用net_timer_check_tmo的时间，用于工作线程等待消息的超时
+ *        下一个定时器在高层时，返回低层转完一圈的时间，届时重新分配后再计算
+ * @return 毫秒数，0表示已有定时器到期，-1表示没有定时器
+ */
+int net_timer_first_tmo(net_timer_wheel_t *wheel) {
+    if (wheel_empty(wheel)) {
+        return -1;
+    }
+
+    uint32_t next = (wheel->now | NET_TIMER_SLOT_MASK) + 1;
+    if (wheel->cnt[0]) {
+        for (uint32_t t = wheel->now; t != next; t++) {
+            if (!nlist_is_empty(&wheel->slots[0][t & NET_TIMER_SLOT_MASK])) {
+                next = t;
+                break;
+            }
+        }
+    }
+
+    int32_t tmo = (int32_t)(next - wheel->jiffies);
+    return tmo > 0 ? tmo : 0;
+}
@@ -1,6 +1,138 @@
 #include "tools.h"
 #include "dbg.h"
 
+#if NET_CHECKSUM_SIMD && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CHECKSUM_USE_SIMD   1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief 按内存顺序，两两字节为一个16位字进行累加，奇数长度时末尾补0
+ *        使用32位宽的读取，累加结果放在64位中，最后再折叠，不影响反码和的结果
+ */
+static uint64_t sum16_scalar(const uint8_t *data, int len) {
+    uint64_t sum = 0;
+
+    while (len >= 4) {
+        uint32_t v;
+        plat_memcpy(&v, data, 4);
+        sum += v;
+        data += 4;
+        len -= 4;
+    }
+
+    if (len >= 2) {
+        uint16_t v;
+        plat_memcpy(&v, data, 2);
+        sum += v;
+        data += 2;
+        len -= 2;
+    }
+
+    // 末尾单独的一个字节，与补上的0组成一个16位字
+    if (len) {
+#if NET_ENDIAN_LITTLE
+        sum += *data;
+#else
+        sum += (uint16_t)(*data << 8);
+#endif
+    }
+
+    return sum;
+}
+
+#if CHECKSUM_USE_SIMD
+// 每个32位通道每轮最多加上2个0xFFFF，限制轮数以避免溢出
+#define SUM16_SIMD_ROUNDS   16384
+
+/**
+ * @brief SSE2版本，每轮处理16字节
+ */
+static uint64_t sum16_sse2(const uint8_t *data, int len) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        int rounds = len / 16 > SUM16_SIMD_ROUNDS ? SUM16_SIMD_ROUNDS : len / 16;
+        for (int i = 0; i < rounds; i++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)data);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            data += 16;
+        }
+        len -= rounds * 16;
+
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    return sum + sum16_scalar(data, len);
+}
+
+/**
+ * @brief AVX2版本，每轮处理32字节，运行时检测到CPU支持时才使用
+ */
+__attribute__((target("avx2")))
+static uint64_t sum16_avx2(const uint8_t *data, int len) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        __m256i acc = _mm256_setzero_si256();
+        int rounds = len / 32 > SUM16_SIMD_ROUNDS ? SUM16_SIMD_ROUNDS : len / 32;
+        for (int i = 0; i < rounds; i++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)data);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            data += 32;
+        }
+        len -= rounds * 32;
+
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (int i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+    }
+
+    return sum + sum16_sse2(data, len);
+}
+
+static uint64_t (*sum16_kernel)(const uint8_t *data, int len) = sum16_sse2;
+#else
+static uint64_t (*sum16_kernel)(const uint8_t *data, int len) = sum16_scalar;
+#endif
+
+/**
+ * @brief 计算16位的反码累加和
+ *
+ * @param offset 该段数据在整个校验区域中的起始偏移，为奇数时累加和需要高低字节对调
+ * @param buf 数据起始地址
+ * @param len 数据长度
+ * @param pre_sum 之前已经计算的累加和，如伪首部、前面的数据块
+ * @param complement 是否对结果取反。分段计算时，中间结果不取反，最后一段再取反
+ */
+uint16_t checksum16(uint32_t offset, const void *buf, int len, uint32_t pre_sum, int complement) {
+    uint64_t sum = sum16_kernel((const uint8_t *)buf, len);
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    // 从奇数位置开始时，每个字节在16位字中的位置与实际相反
+    if (offset & 0x1) {
+        sum = swap_u16((uint16_t)sum);
+    }
+
+    sum += pre_sum;
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return complement ? (uint16_t)~sum : (uint16_t)sum;
+}
+
 static int is_little_endian(void) {
     // 存储字节顺序，从低地址->高地址
     // 大端：0x12, 0x34;小端：0x34, 0x12
@@ -22,6 +154,15 @@ net_err_t tools_init(void) {
         dbg_error(DBG_TOOLS, "check endian faild.");
         return NET_ERR_SYS;
     }
+
+#if CHECKSUM_USE_SIMD
+    // 根据CPU的实际能力选择校验和的实现
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        sum16_kernel = sum16_avx2;
+        dbg_info(DBG_TOOLS, "checksum use avx2.");
+    }
+#endif
     
     dbg_info(DBG_TOOLS, "done.");
     return NET_ERR_OK;
@@ -11,66 +11,304 @@
 #include "sys_plat.h"
 #include "ether.h"
 #include "exmsg.h"
+#include "mblock.h"
 
 /**
- * @brief 接收线程
+ * @brief 驱动自有的接收帧缓存
+ *        pcap_dispatch回调中的数据只在回调返回前有效，无法直接交给协议栈长期持有。
+ *        因此驱动将数据帧整体放入自己的帧缓存中，再以外部数据块的方式交给pktbuf，
+ *        避免逐块分配和分段复制。协议栈释放数据包时，帧缓存通过回调归还给驱动
  */
-void recv_thread(void *arg) {
-    plat_printf("recv thread is running...\n");
+typedef struct _pcap_frame_t {
+    uint8_t data[sizeof(ether_pkt_t)];
+}pcap_frame_t;
 
-    netif_t *netif = (netif_t *)arg;
-    pcap_t *pcap = (pcap_t *)netif->ops_data;
-    while (1) {
-        struct pcap_pkthdr *pkthdr;
-        const uint8_t *pkt_data;
-        if (pcap_next_ex(pcap, &pkthdr, &pkt_data) != 1) {
-            continue;
+static pcap_frame_t frame_buffer[PCAP_RX_FRAME_CNT];
+static mblock_t frame_list;                     // 空闲帧缓存列表
+static int pcap_inited;
+
+/**
+ * @brief pcap接口的驱动数据
+ */
+typedef struct _pcap_dev_t {
+    pcap_t *pcap;
+    pcap_waiter_t waiter;               // 驱动线程空闲时在此等待
+    int sleeping;                       // 驱动线程正在睡眠，发送时需要将其唤醒
+    int rx_arm;                         // 忙轮询的工作线程正在阻塞等待，有数据到达时需要通知
+    int stop;                           // 关闭接口时置位，通知驱动线程退出
+    int exited;                         // 驱动线程已退出，此后才能释放驱动数据
+    pcap_sendq_t sendq;                 // 批量发送队列
+    int tx_cnt;                         // 发送队列中的数据帧数量
+    pktbuf_t *tx_bufs[PCAP_TX_BATCH];   // 发送队列中数据帧对应的数据包，发送后释放
+    uint8_t tx_buffer[1500+6+6+2];      // 数据块过多时拼接数据包的缓存，帧大小，4位校验不用加
+}pcap_dev_t;
+
+static pcap_dev_t dev_buffer[NETIF_DEV_CNT];
+static mblock_t dev_list;                       // 空闲驱动数据列表
+
+/**
+ * @brief 帧缓存释放回调，由pktbuf在释放外部数据块时调用
+ */
+static void pcap_frame_release(void *arg, uint8_t *data) {
+    mblock_free(&frame_list, arg);
+}
+
+/**
+ * @brief 一次pcap_dispatch的接收上下文
+ *        帧缓存在调用前整批分配，回调中只复制数据，数据包在调用后整批分配
+ */
+typedef struct _pcap_rx_batch_t {
+    int cnt;                                // 已接收的数据帧数量
+    int frame_cnt;                          // 预先分配的帧缓存数量
+    int ext_cnt;                            // 已使用的帧缓存数量
+    pcap_frame_t *frames[PCAP_RX_BATCH];
+    int sizes[PCAP_RX_BATCH];               // 各帧缓存中的数据大小
+    pktbuf_t *bufs[PCAP_RX_BATCH];          // 按接收顺序排列，使用帧缓存的位置为0，调用后再填入
+}pcap_rx_batch_t;
+
+/**
+ * @brief pcap_dispatch的回调，每个数据帧调用一次
+ *        优先复制到帧缓存中，帧过大或帧缓存不足时退回到逐块复制的方式
+ */
+static void pcap_rx_handler(u_char *user, const struct pcap_pkthdr *pkthdr, const u_char *pkt_data) {
+    pcap_rx_batch_t *batch = (pcap_rx_batch_t *)user;
+
+    // 只有caplen字节被捕获，len可能超过snaplen
+    int size = pkthdr->caplen;
+    if ((size <= sizeof(pcap_frame_t)) && (batch->ext_cnt < batch->frame_cnt)) {
+        plat_memcpy(batch->frames[batch->ext_cnt]->data, pkt_data, size);
+        batch->sizes[batch->ext_cnt++] = size;
+        batch->bufs[batch->cnt++] = (pktbuf_t *)0;
+        return;
+    }
+
+    pktbuf_t *buf = pktbuf_alloc(size);
+    if (buf == (pktbuf_t *)0) {
+        dbg_warning(DBG_NETIF, "buf is none");
+        return;
+    }
+    pktbuf_write(buf, (uint8_t *)pkt_data, size);
+    batch->bufs[batch->cnt++] = buf;
+}
+
+/**
+ * @brief 为帧缓存中的数据帧整批分配数据包，按接收顺序一次性交给协议栈
+ *        未用到的帧缓存归还给驱动
+ */
+static void pcap_rx_deliver(netif_t *netif, pcap_rx_batch_t *batch) {
+    pktbuf_t *ext_bufs[PCAP_RX_BATCH];
+    uint8_t *data[PCAP_RX_BATCH];
+    for (int i = 0; i < batch->ext_cnt; i++) {
+        data[i] = batch->frames[i]->data;
+    }
+    int ext_cnt = pktbuf_alloc_ext_bulk(ext_bufs, data, batch->sizes, batch->ext_cnt,
+                                        pcap_frame_release, (void **)batch->frames);
+    if (ext_cnt < batch->frame_cnt) {
+        mblock_free_bulk(&frame_list, (void **)batch->frames + ext_cnt, batch->frame_cnt - ext_cnt);
+    }
+
+    // 填入帧缓存对应的数据包，没有分配到数据包的帧被丢弃
+    int cnt = 0, ext = 0;
+    for (int i = 0; i < batch->cnt; i++) {
+        if (batch->bufs[i]) {
+            batch->bufs[cnt++] = batch->bufs[i];
+        } else if (ext < ext_cnt) {
+            batch->bufs[cnt++] = ext_bufs[ext++];
         }
+    }
 
-        // 将pkt_data的数据拷贝到自己的协议栈中
-        pktbuf_t *buf = pktbuf_alloc(pkthdr->len);
-        if (buf == (pktbuf_t *)0) {
-            dbg_warning(DBG_NETIF, "buf is none");
-            continue;
+    if (cnt > 0) {
+        netif_put_in_batch(netif, batch->bufs, cnt);
+    }
+}
+
+/**
+ * @brief 接收最多budget个数据帧，每次pcap_dispatch最多接收PCAP_RX_BATCH个
+ * @return 接收的数据帧数量
+ */
+static int pcap_rx(netif_t *netif, pcap_t *pcap, int budget) {
+    int total = 0;
+
+    while (total < budget) {
+        int want = budget - total < PCAP_RX_BATCH ? budget - total : PCAP_RX_BATCH;
+
+        pcap_rx_batch_t batch;
+        batch.cnt = 0;
+        batch.ext_cnt = 0;
+        batch.frame_cnt = mblock_alloc_bulk(&frame_list, (void **)batch.frames, want);
+
+        int cnt = pcap_dispatch(pcap, want, pcap_rx_handler, (u_char *)&batch);
+        if (cnt < 0) {
+            dbg_warning(DBG_NETIF, "pcap dispatch failed: %s", pcap_geterr(pcap));
         }
-        pktbuf_write(buf, (uint8_t *)pkt_data, pkthdr->len);
-        
-        // 将buf加入输入队列中
-        if (netif_put_in(netif, buf, 0) < 0) {
-            dbg_warning(DBG_NETIF, "netif %s in_q full", netif->name);
-            pktbuf_free(buf);
-            continue;
+        pcap_rx_deliver(netif, &batch);
+
+        if (cnt < want) {
+            total += cnt > 0 ? cnt : 0;
+            break;
         }
+        total += cnt;
     }
+
+    return total;
 }
 
 /**
- * @brief 发送线程
+ * @brief 忙轮询模式下由工作线程调用，接收最多budget个数据帧
+ * @return 接收的数据帧数量
  */
-void xmit_thread(void *arg) {
-    plat_printf("xmit thread is running...\n");
+static int netif_pcap_poll(struct _netif_t *netif, int budget) {
+    pcap_dev_t *dev = (pcap_dev_t *)netif->ops_data;
+    return pcap_rx(netif, dev->pcap, budget);
+}
 
-    netif_t *netif = (netif_t *)arg;
-    pcap_t *pcap = (pcap_t *)netif->ops_data;
-    static uint8_t rw_buffer[1500+6+6+2];  // 帧大小，4位校验不用加
-    while (1) {
-        // 从输出队列中取数据包
-        pktbuf_t *buf = netif_get_out(netif, 0);
-        if (buf == (pktbuf_t *)0) {
-            continue;
-        }
+/**
+ * @brief 发送队列中积累的所有数据帧，并释放对应的数据包
+ */
+static void pcap_tx_flush(pcap_dev_t *dev) {
+    if (dev->tx_cnt == 0) {
+        return;
+    }
+
+    pcap_sendq_flush(dev->sendq);
+    for (int i = 0; i < dev->tx_cnt; i++) {
+        pktbuf_free(dev->tx_bufs[i]);
+    }
+    dev->tx_cnt = 0;
+}
 
-        int total_size = buf->total_size;
-        plat_memset(rw_buffer, 0, sizeof(rw_buffer));
-        pktbuf_read(buf, rw_buffer, total_size);
+/**
+ * @brief 将数据包加入发送队列，积累满一批时一次发送
+ *        发送队列直接引用数据包中各数据块的数据，因此数据包在发送前一直由驱动持有
+ */
+static void pcap_tx_queue(pcap_dev_t *dev, pktbuf_t *buf) {
+    int total_size = buf->total_size;
+    if ((total_size == 0) || (total_size > sizeof(dev->tx_buffer))) {
+        dbg_warning(DBG_NETIF, "pcap send: packet size error %d", total_size);
         pktbuf_free(buf);
+        return;
+    }
 
-        if (pcap_inject(pcap, rw_buffer, total_size) == -1) {
-            fprintf(stderr, "pcap send failed: %s\n", pcap_geterr(pcap));
+    struct iovec iov[PKTBUF_IOV_MAX];
+    int iov_cnt = pktbuf_to_iovec(buf, iov, PKTBUF_IOV_MAX);
+    if ((iov_cnt >= 0) && (pcap_sendq_add(dev->sendq, iov, iov_cnt) < 0)) {
+        dbg_warning(DBG_NETIF, "pcap send queue add failed, size %d", total_size);
+        iov_cnt = -1;
+    }
+    if (iov_cnt < 0) {
+        // 数据块过多或无法加入发送队列，退回到逐块读取后单独发送，先发送队列中的数据帧以保持顺序
+        pcap_tx_flush(dev);
+
+        pktbuf_reset_acc(buf);
+        pktbuf_read(buf, dev->tx_buffer, total_size);
+        if (pcap_inject(dev->pcap, dev->tx_buffer, total_size) == -1) {
+            fprintf(stderr, "pcap send failed: %s\n", pcap_geterr(dev->pcap));
             fprintf(stderr, "pcap send: pcaket size %d\n", total_size);
+        }
+        pktbuf_free(buf);
+        return;
+    }
+
+    dev->tx_bufs[dev->tx_cnt++] = buf;
+    if (dev->tx_cnt >= PCAP_TX_BATCH) {
+        pcap_tx_flush(dev);
+    }
+}
+
+/**
+ * @brief 从输出队列中取出最多budget个数据包加入发送队列
+ *        输出队列已空时立即发送积累的数据帧，不再等待凑满一批，以免增加延迟
+ * @return 取出的数据包数量
+ */
+static int pcap_tx(netif_t *netif, pcap_dev_t *dev, int budget) {
+    pktbuf_t *bufs[PCAP_TX_BUDGET];
+    int want = budget < PCAP_TX_BUDGET ? budget : PCAP_TX_BUDGET;
+    int cnt = netif_get_out_batch(netif, bufs, want, -1);
+
+    for (int i = 0; i < cnt; i++) {
+        pcap_tx_queue(dev, bufs[i]);
+    }
+
+    if (cnt < want) {
+        pcap_tx_flush(dev);
+    }
+    return cnt;
+}
+
+#if EXMSG_BUSY_POLL
+/**
+ * @brief 忙轮询的工作线程已退回阻塞等待时，pcap有数据可读则通知0号工作线程恢复轮询
+ *        每次设置只通知一次，此后由工作线程自己接收
+ */
+static void pcap_rx_kick(netif_t *netif, pcap_dev_t *dev, int ready) {
+    if (ready && sys_atomic_xchg(&dev->rx_arm, 0)) {
+        if (exmsg_netif_in(netif, 0) < 0) {
+            // 没有发出通知，下次等待时重试
+            sys_atomic_store(&dev->rx_arm, 1);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief 驱动线程，负责接口的收发
+ *        有数据时连续收发；连续空闲一段时间后睡眠，直到pcap有数据可读或netif_pcap_xmit将其唤醒。
+ *        睡眠前先置sleeping标志再检查输出队列，与netif_pcap_xmit中先入队再检查标志配对，
+ *        两者之间不会丢失唤醒。
+ *        忙轮询模式下由工作线程接收，只在其退回阻塞等待（rx_arm）时才等待接收，有数据时通知它。
+ *        关闭接口时置stop标志并唤醒，线程发送完已积累的数据帧后退出，退出前最后置exited标志
+ */
+static void io_thread(void *arg) {
+    plat_printf("pcap io thread is running...\n");
+
+    netif_t *netif = (netif_t *)arg;
+    pcap_dev_t *dev = (pcap_dev_t *)netif->ops_data;
+    int idle_cnt = 0;
+    while (!sys_atomic_load(&dev->stop)) {
+        int cnt = pcap_tx(netif, dev, PCAP_TX_BUDGET);
+#if !EXMSG_BUSY_POLL
+        // 忙轮询模式下由工作线程接收
+        cnt += pcap_rx(netif, dev->pcap, PCAP_RX_BUDGET);
+#endif
+        if (cnt > 0) {
+#if EXMSG_BUSY_POLL
+            // 发送繁忙时不会睡眠，顺便检查一下是否需要通知
+            if (sys_atomic_load(&dev->rx_arm)) {
+                pcap_rx_kick(netif, dev, pcap_waiter_wait(dev->waiter, 1, 0));
+            }
+#endif
+            idle_cnt = 0;
+            continue;
+        }
+
+        if (++idle_cnt < PCAP_IDLE_SPIN) {
+            sys_cpu_relax();
             continue;
         }
+
+        // 设置rx_arm后也会唤醒睡眠中的本线程，与此处先置标志再读取配对
+        sys_atomic_store(&dev->sleeping, 1);
+        sys_atomic_fence();
+        // rx：是否等待接收，等待后为是否有数据可读
+        int rx = !EXMSG_BUSY_POLL || sys_atomic_load(&dev->rx_arm);
+        if ((fixq_count(&netif->out_q) == 0) && !sys_atomic_load(&dev->stop)) {
+            rx = pcap_waiter_wait(dev->waiter, rx, PCAP_WAIT_TMO);
+        } else {
+            rx = 0;
+        }
+        sys_atomic_store(&dev->sleeping, 0);
+#if EXMSG_BUSY_POLL
+        pcap_rx_kick(netif, dev, rx);
+#endif
+        idle_cnt = 0;
     }
+
+    pcap_tx_flush(dev);
+    pktbuf_thread_exit();
+    plat_printf("pcap io thread exit.\n");
+
+    // 此后不能再访问dev和netif
+    sys_atomic_store(&dev->exited, 1);
 }
 
 /**
@@ -79,9 +317,14 @@ void xmit_thread(void *arg) {
  * @param driver_data 传入的驱动数据
  */
 static net_err_t netif_pcap_open(struct _netif_t *netif, void *data) {
+    // 打开成功后才指向驱动数据，此前出错时netif_pcap_close据此忽略
+    netif->ops_data = (void *)0;
+
     // 打开pcap设备
     pcap_data_t *dev_data = (pcap_data_t *)data;
-    pcap_t *pcap = pcap_device_open(dev_data->ip, dev_data->hwaddr);
+    int snaplen = dev_data->snaplen > 0 ? dev_data->snaplen : PCAP_SNAPLEN;
+    int buffer_size = dev_data->buffer_size > 0 ? dev_data->buffer_size : PCAP_BUFFER_SIZE;
+    pcap_t *pcap = pcap_device_open(dev_data->ip, dev_data->hwaddr, snaplen, buffer_size);
     if (pcap == (pcap_t *)0) {
         dbg_error(DBG_NETIF, "pcap open failed! name: %s\n", netif->name);
         return NET_ERR_IO;
@@ -94,14 +337,69 @@ static net_err_t netif_pcap_open(struct _netif_t *netif, void *data) {
      */
 
 
+    // 帧缓存和驱动数据由所有pcap接口共享，只需初始化一次
+    if (!pcap_inited) {
+        net_err_t err = mblock_init(&frame_list, frame_buffer, sizeof(pcap_frame_t), PCAP_RX_FRAME_CNT, NLOCKER_LOCKFREE);
+        if (err < 0) {
+            dbg_error(DBG_NETIF, "pcap frame list init failed.");
+            pcap_close(pcap);
+            return err;
+        }
+
+        err = mblock_init(&dev_list, dev_buffer, sizeof(pcap_dev_t), NETIF_DEV_CNT, NLOCKER_THREAD);
+        if (err < 0) {
+            dbg_error(DBG_NETIF, "pcap dev list init failed.");
+            pcap_close(pcap);
+            return err;
+        }
+        pcap_inited = 1;
+    }
+
+    // 驱动线程空闲时睡眠等待，因此读取不能阻塞
+    char err_buf[PCAP_ERRBUF_SIZE];
+    if (pcap_setnonblock(pcap, 1, err_buf) != 0) {
+        dbg_error(DBG_NETIF, "pcap set nonblock failed: %s", err_buf);
+        pcap_close(pcap);
+        return NET_ERR_IO;
+    }
+
+    pcap_dev_t *dev = (pcap_dev_t *)mblock_alloc(&dev_list, -1);
+    if (dev == (pcap_dev_t *)0) {
+        dbg_error(DBG_NETIF, "pcap dev alloc failed.");
+        pcap_close(pcap);
+        return NET_ERR_MEM;
+    }
+
+    // 忙轮询模式下由工作线程接收，驱动线程只在工作线程退回阻塞等待时才等待接收
+    dev->waiter = pcap_waiter_create(pcap, 1);
+    if (dev->waiter == (pcap_waiter_t)0) {
+        dbg_error(DBG_NETIF, "pcap waiter create failed.");
+        mblock_free(&dev_list, dev);
+        pcap_close(pcap);
+        return NET_ERR_SYS;
+    }
+
+    dev->sendq = pcap_sendq_create(pcap, PCAP_TX_BATCH, PKTBUF_IOV_MAX, sizeof(dev->tx_buffer));
+    if (dev->sendq == (pcap_sendq_t)0) {
+        dbg_error(DBG_NETIF, "pcap send queue create failed.");
+        pcap_waiter_free(dev->waiter);
+        mblock_free(&dev_list, dev);
+        pcap_close(pcap);
+        return NET_ERR_SYS;
+    }
+    dev->pcap = pcap;
+    dev->sleeping = 0;
+    dev->rx_arm = 0;
+    dev->stop = 0;
+    dev->exited = 0;
+    dev->tx_cnt = 0;
+
     netif->type = NETIF_TYPE_ETHER;  // 以太网类型
     netif->mtu = ETHER_MTU;
-    netif->ops_data = pcap;
+    netif->ops_data = dev;
     netif_set_hwaddr(netif, dev_data->hwaddr, 6);  // 帧中mac地址大小为6字节
 
-    sys_thread_create(recv_thread, netif);
-    sys_thread_create(xmit_thread, netif);
-    
+    sys_thread_create(io_thread, netif);
     return NET_ERR_OK;
 }
 
@@ -110,32 +408,68 @@ static net_err_t netif_pcap_open(struct _netif_t *netif, void *data) {
  * @param netif 待关闭的接口
  */
 static void netif_pcap_close (struct _netif_t *netif) {
-    pcap_t *pcap = (pcap_t *)netif->ops_data;
-    pcap_close(pcap);
+    pcap_dev_t *dev = (pcap_dev_t *)netif->ops_data;
+    if (dev == (pcap_dev_t *)0) {
+        return;
+    }
+
+    // 先让驱动线程退出，它还在使用pcap、等待器和发送队列
+    sys_atomic_store(&dev->stop, 1);
+    sys_atomic_fence();
+    pcap_waiter_wake(dev->waiter);
+    while (!sys_atomic_load(&dev->exited)) {
+        sys_sleep(1);
+    }
+
+    pcap_close(dev->pcap);
+    pcap_waiter_free(dev->waiter);
+    pcap_sendq_free(dev->sendq);
+    mblock_free(&dev_list, dev);
+    netif->ops_data = (void *)0;
 }
 
 /**
  * @brief 向接口发送命令
+ *        输出队列中的数据包由驱动线程取出并发送，这里只在驱动线程睡眠时将其唤醒，
+ *        驱动线程忙碌时不产生系统调用。
+ *        不能像环回接口那样将数据包转入输入队列，否则输入队列会有接收线程之外的第二个写入者
  */
 static net_err_t netif_pcap_xmit (struct _netif_t *netif) {
-    // 从输出队列取收到的数据包，然后写入输入队列，并通知主线程处理
-    pktbuf_t * pktbuf = netif_get_out(netif, -1);
-    if (pktbuf) {
-        // 写入接收队列
-        net_err_t err = netif_put_in(netif, pktbuf, -1);
-        if (err < 0) {
-            dbg_warning(DBG_NETIF, "netif full");
-            pktbuf_free(pktbuf);
-            return err;
-        }
-    }
+    pcap_dev_t *dev = (pcap_dev_t *)netif->ops_data;
 
+    // 与驱动线程中先置标志再检查队列配对：数据包已入队，先屏障再检查标志
+    sys_atomic_fence();
+    if (sys_atomic_load(&dev->sleeping) && sys_atomic_xchg(&dev->sleeping, 0)) {
+        pcap_waiter_wake(dev->waiter);
+    }
     return NET_ERR_OK;
 }
 
+/**
+ * @brief 忙轮询的工作线程退回阻塞等待前调用，由驱动线程代为等待接收，有数据到达时通知
+ * @return 1 已设置，0 pcap没有可等待的描述符，工作线程只能定时轮询
+ */
+static int netif_pcap_poll_arm(struct _netif_t *netif) {
+    pcap_dev_t *dev = (pcap_dev_t *)netif->ops_data;
+    if (!pcap_waiter_has_rx(dev->waiter)) {
+        return 0;
+    }
+
+    // 驱动线程可能正在只等待发送的睡眠中，唤醒它重新等待。配对方式与netif_pcap_xmit相同
+    sys_atomic_store(&dev->rx_arm, 1);
+    sys_atomic_fence();
+    if (sys_atomic_load(&dev->sleeping) && sys_atomic_xchg(&dev->sleeping, 0)) {
+        pcap_waiter_wake(dev->waiter);
+    }
+    return 1;
+}
+
 // 初始化ops的相关接口函数
 const netif_ops_t netdev_ops = {
     .open  = netif_pcap_open,
     .close = netif_pcap_close,
     .xmit  = netif_pcap_xmit,
+    .poll  = netif_pcap_poll,
+    .poll_arm = netif_pcap_poll_arm,
+    .rx_single = 1,                 // 只有驱动线程写入输入队列
 };
\ No newline at end of file
@@ -8,6 +8,8 @@
 typedef struct _pcap_data_t {
     const char *ip;         // 使用的网卡
     const uint8_t *hwaddr;  // 网卡的物理地址
+    int snaplen;            // 每帧最多捕获的字节数，为0时使用PCAP_SNAPLEN
+    int buffer_size;        // pcap内核接收缓存的大小，为0时使用PCAP_BUFFER_SIZE
 }pcap_data_t;
 
 extern const netif_ops_t netdev_ops;
@@ -2,6 +2,9 @@
  * @file sys_plat.c
  * @brief 不同操作系统平台的接口
  */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                 // pthread_setaffinity_np、cpu_set_t
+#endif
 #include "sys_plat.h"
 
 #if defined(SYS_PLAT_X86OS)
@@ -13,7 +16,7 @@
 #include "cpu/irq.h"
 #include "core/task.h"
 
-#define NET_TASK_NR                 3           // 如果收发均有线程，至少3个。否则1个
+#define NET_TASK_NR                 (2 + EXMSG_WORKER_CNT)  // 收发线程及各工作线程
 #define NET_SEM_NR                  100         // 信号量数量
 #define NET_MUTEX_NR                100         // 互斥锁数量
 
@@ -66,6 +69,21 @@ void sys_sem_notify(sys_sem_t sem) {
     sem_notify(sem);
 }
 
+int sys_sem_try_wait_n(sys_sem_t sem, int n) {
+    int got = 0;
+    while ((got < n) && (sem_count(sem) > 0)) {
+        sem_wait(sem);
+        got++;
+    }
+    return got;
+}
+
+void sys_sem_notify_n(sys_sem_t sem, int n) {
+    while (n-- > 0) {
+        sem_notify(sem);
+    }
+}
+
 // 互斥信号量：由具体平台实现
 sys_mutex_t sys_mutex_create(void) {
     sys_mutex_t m = (sys_mutex_t)mblock_alloc(&mutex_mblock, -1);
@@ -123,6 +141,23 @@ void sys_sleep(int ms) {
     sys_msleep(ms);
 }
 
+void sys_thread_yield(void) {
+    sys_msleep(0);
+}
+
+int sys_thread_bind_cpu(sys_thread_t thread, int cpu) {
+    // 单核系统，不支持绑定
+    return -1;
+}
+
+void *sys_mem_map(size_t *size) {
+    return malloc(*size);
+}
+
+void sys_mem_unmap(void *mem, size_t size) {
+    free(mem);
+}
+
 void sys_plat_init(void) {
     mblock_init(&task_mblock, task_tbl, sizeof(net_task_t), NET_TASK_NR, NLOCKER_NONE);
     mblock_init(&sem_mblock, sem_tbl, sizeof(sem_t), NET_SEM_NR, NLOCKER_NONE);
@@ -221,6 +256,24 @@ void sys_sem_notify(sys_sem_t sem) {
     ReleaseSemaphore(sem, 1, NULL);
 }
 
+/**
+ * @brief 不等待，尝试获取最多n个信号量计数，返回实际获取的数量
+ */
+int sys_sem_try_wait_n(sys_sem_t sem, int n) {
+    int got = 0;
+    while ((got < n) && (WaitForSingleObject(sem, 0) == WAIT_OBJECT_0)) {
+        got++;
+    }
+    return got;
+}
+
+/**
+ * @brief 一次增加n个信号量计数
+ */
+void sys_sem_notify_n(sys_sem_t sem, int n) {
+    ReleaseSemaphore(sem, n, NULL);
+}
+
 /**
  * 创建线程互斥锁
  * @return 创建的互斥信号量
@@ -286,6 +339,54 @@ void sys_sleep(int ms) {
     Sleep(ms);
 }
 
+/**
+ * @brief 让出cpu，给其它就绪线程运行的机会
+ */
+void sys_thread_yield(void) {
+    SwitchToThread();
+}
+
+/**
+ * @brief 将线程绑定到指定的cpu上运行
+ * @return 0成功，-1失败
+ */
+int sys_thread_bind_cpu(sys_thread_t thread, int cpu) {
+    if ((cpu < 0) || (cpu >= (int)(sizeof(DWORD_PTR) * 8))) {
+        return -1;
+    }
+
+    return SetThreadAffinityMask(thread, (DWORD_PTR)1 << cpu) ? 0 : -1;
+}
+
+/**
+ * @brief 从系统中映射一块内存，大小足够时先尝试大页，失败时使用普通页
+ *        需要SeLockMemoryPrivilege权限才能使用大页
+ * @param size 希望的大小，返回时为实际映射的大小
+ */
+void *sys_mem_map(size_t *size) {
+    size_t large = GetLargePageMinimum();
+    if (large && (*size >= large / 2)) {
+        size_t large_size = (*size + large - 1) & ~(large - 1);
+        void *mem = VirtualAlloc(NULL, large_size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (mem) {
+            *size = large_size;
+            return mem;
+        }
+    }
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    *size = (*size + info.dwPageSize - 1) & ~((size_t)info.dwPageSize - 1);
+    return VirtualAlloc(NULL, *size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+/**
+ * @brief 释放sys_mem_map映射的内存
+ */
+void sys_mem_unmap(void *mem, size_t size) {
+    VirtualFree(mem, 0, MEM_RELEASE);
+}
+
 void sys_plat_init(void) {
 }
 
@@ -301,37 +402,186 @@ void sys_plat_init(void) {
 #include <string.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 
+#if SYS_SEM_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 int load_pcap_lib(void) {
     return 0;
 }
 
 /**
- * @brief 获取当前时间
+ * @brief 获取当前时间，使用单调时钟，不受系统时间调整的影响
  */
 void sys_time_curr (net_time_t * time) {
-    gettimeofday(time, NULL);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    time->tv_sec = ts.tv_sec;
+    time->tv_usec = ts.tv_nsec / 1000;
 }
 
 /**
- * @brief 返回当前时间与传入的time之间时间差值, 调用完成之后，time被更新为当前时间
+ * @brief 返回当前时间与传入的time之间时间差值, 调用完成之后，time前进相应的毫秒数
  * 
- * 第一次调用时，返回的时间差值无效
+ * 不足1ms的部分保留在time中，频繁调用时不会丢失时间。第一次调用时，返回的时间差值无效
  */
 int sys_time_goes (net_time_t * pre) {
     // 获取当前时间
-    struct timeval curr;
-    gettimeofday(&curr, NULL);
+    net_time_t curr;
+    sys_time_curr(&curr);
 
     // 记录过去了多少毫秒
-    int diff_ms = (curr.tv_sec - pre->tv_sec) * 1000 + (curr.tv_usec - pre->tv_usec) / 1000;
+    int64_t diff_us = (int64_t)(curr.tv_sec - pre->tv_sec) * 1000000 + (curr.tv_usec - pre->tv_usec);
+    int diff_ms = (int)(diff_us / 1000);
 
     // 记录下这次调用的时间
-    *pre  = curr;
+    int64_t usec = pre->tv_usec + (int64_t)diff_ms * 1000;
+    pre->tv_sec += usec / 1000000;
+    pre->tv_usec = usec % 1000000;
     return diff_ms;
 }
 
+#if SYS_SEM_FUTEX
+
+/**
+ * @brief futex系统调用，glibc没有提供封装
+ */
+static int sys_futex(int *addr, int op, int val, const struct timespec *tmo) {
+    return (int)syscall(SYS_futex, addr, op, val, tmo, NULL, 0);
+}
+
+sys_sem_t sys_sem_create(int init_count) {
+    sys_sem_t sem = (sys_sem_t)malloc(sizeof(struct _xsys_sem_t));
+    if (!sem) {
+        return (sys_sem_t)0;
+    }
+
+    sem->count = init_count;
+    sem->waiters = 0;
+    return sem;
+}
+
+/**
+ * 释放掉信号量
+ */
+void sys_sem_free(sys_sem_t sem) {
+    free(sem);
+}
+
+/**
+ * 不等待，尝试获取一个信号量计数
+ * @return 1 获取成功，0 计数为0
+ */
+static int sem_try_take(sys_sem_t sem) {
+    int count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count > 0) {
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 等待信号量
+ *        计数大于0时只需一次原子操作；否则登记为等待者，在futex上睡眠直到被唤醒或超时。
+ *        超时以CLOCK_MONOTONIC计算，不受系统时间调整的影响
+ * @param sem 等待的信号量
+ * @param tmo 等待的超时时间(ms)，为0时一直等待
+ */
+int sys_sem_wait(sys_sem_t sem, uint32_t tmo_ms) {
+    if (sem_try_take(sem)) {
+        return 0;
+    }
+
+    struct timespec end;
+    if (tmo_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        end.tv_sec += tmo_ms / 1000;
+        end.tv_nsec += (tmo_ms % 1000) * 1000000L;
+        if (end.tv_nsec >= 1000000000L) {
+            end.tv_sec++;
+            end.tv_nsec -= 1000000000L;
+        }
+    }
+
+    // 先登记等待，再检查计数，与通知方的先加计数、再检查等待者配对，避免错过唤醒
+    __atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    int err = 0;
+    while (!sem_try_take(sem)) {
+        struct timespec ts, *tmo = (struct timespec *)0;
+        if (tmo_ms > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ts.tv_sec = end.tv_sec - now.tv_sec;
+            ts.tv_nsec = end.tv_nsec - now.tv_nsec;
+            if (ts.tv_nsec < 0) {
+                ts.tv_sec--;
+                ts.tv_nsec += 1000000000L;
+            }
+            if (ts.tv_sec < 0) {
+                err = -1;
+                break;
+            }
+            tmo = &ts;
+        }
+
+        // 计数仍为0时才睡眠，FUTEX_WAIT的超时为相对时间，以CLOCK_MONOTONIC计
+        sys_futex(&sem->count, FUTEX_WAIT_PRIVATE, 0, tmo);
+    }
+    __atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return err;
+}
+
+/**
+ * 一次增加n个信号量计数，有线程等待时才进入内核唤醒
+ * @param sem 待通知的信号量
+ * @param n 增加的数量
+ */
+void sys_sem_notify_n(sys_sem_t sem, int n) {
+    __atomic_add_fetch(&sem->count, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0) {
+        sys_futex(&sem->count, FUTEX_WAKE_PRIVATE, n, (struct timespec *)0);
+    }
+}
+
+/**
+ * 通知信号量
+ * @param sem 待通知的信号量
+ */
+void sys_sem_notify(sys_sem_t sem) {
+    sys_sem_notify_n(sem, 1);
+}
+
+/**
+ * 不等待，尝试获取最多n个信号量计数
+ * @param sem 信号量
+ * @param n 希望获取的数量
+ * @return 实际获取的数量
+ */
+int sys_sem_try_wait_n(sys_sem_t sem, int n) {
+    int count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count > 0) {
+        int got = count < n ? count : n;
+        if (got <= 0) {
+            return 0;
+        }
+
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - got, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return got;
+        }
+    }
+    return 0;
+}
+
+#else
+
 sys_sem_t sys_sem_create(int init_count) {
     sys_sem_t sem = (sys_sem_t)malloc(sizeof(struct _xsys_sem_t));
     if (!sem) {
@@ -374,9 +624,13 @@ int sys_sem_wait(sys_sem_t sem, uint32_t tmo_ms) {
         int ret;
 
         if (tmo_ms > 0) {
+            // pthread_cond_timedwait使用绝对时间，以当前时间加上毫秒级的超时
+            struct timeval now;
             struct timespec ts;
-            ts.tv_nsec = (tmo_ms % 1000) * 1000000L;
-            ts.tv_sec = time(NULL) + tmo_ms / 1000;
+            gettimeofday(&now, NULL);
+            long nsec = now.tv_usec * 1000L + (tmo_ms % 1000) * 1000000L;
+            ts.tv_sec = now.tv_sec + tmo_ms / 1000 + nsec / 1000000000L;
+            ts.tv_nsec = nsec % 1000000000L;
             ret = pthread_cond_timedwait(&sem->cond, &sem->locker, &ts);
             if (ret == ETIMEDOUT) {
                 pthread_mutex_unlock(&(sem->locker));
@@ -411,6 +665,43 @@ void sys_sem_notify(sys_sem_t sem) {
     pthread_mutex_unlock(&(sem->locker));
 }
 
+/**
+ * 不等待，尝试获取最多n个信号量计数
+ * @param sem 信号量
+ * @param n 希望获取的数量
+ * @return 实际获取的数量
+ */
+int sys_sem_try_wait_n(sys_sem_t sem, int n) {
+    pthread_mutex_lock(&(sem->locker));
+
+    int got = sem->count < n ? sem->count : n;
+    if (got < 0) {
+        got = 0;
+    }
+    sem->count -= got;
+
+    pthread_mutex_unlock(&(sem->locker));
+    return got;
+}
+
+/**
+ * 一次增加n个信号量计数
+ * @param sem 待通知的信号量
+ * @param n 增加的数量
+ */
+void sys_sem_notify_n(sys_sem_t sem, int n) {
+    pthread_mutex_lock(&(sem->locker));
+
+    sem->count += n;
+
+    // 可能有多个线程在等待，全部唤醒
+    pthread_cond_broadcast(&(sem->cond));
+
+    pthread_mutex_unlock(&(sem->locker));
+}
+
+#endif // SYS_SEM_FUTEX
+
 /**
  * 创建一个线程
  * @param entry 线程的入口函数
@@ -429,6 +720,8 @@ sys_thread_t sys_thread_create(void (*entry)(void * arg), void* arg) {
         return (pthread_t)0;
     }
 
+    // 不会被join，线程退出时（如关闭网络接口时的驱动线程）自动回收资源
+    pthread_detach(pthread);
     return pthread;
 }
 
@@ -446,6 +739,63 @@ void sys_sleep(int ms) {
     usleep(1000 * ms);
 }
 
+/**
+ * @brief 让出cpu，给其它就绪线程运行的机会
+ */
+void sys_thread_yield(void) {
+    sched_yield();
+}
+
+/**
+ * @brief 将线程绑定到指定的cpu上运行，Mac上不支持
+ * @return 0成功，-1失败
+ */
+int sys_thread_bind_cpu(sys_thread_t thread, int cpu) {
+#if defined(__linux__)
+    if ((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+        return -1;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) ? -1 : 0;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief 从系统中映射一块内存，大小足够时先尝试大页，失败时（如未预留大页）使用普通页
+ * @param size 希望的大小，返回时为实际映射的大小
+ */
+void *sys_mem_map(size_t *size) {
+    void *mem;
+
+#ifdef MAP_HUGETLB
+    if (*size >= SYS_HUGE_PAGE_SIZE / 2) {
+        size_t huge_size = (*size + SYS_HUGE_PAGE_SIZE - 1) & ~((size_t)SYS_HUGE_PAGE_SIZE - 1);
+        mem = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            *size = huge_size;
+            return mem;
+        }
+    }
+#endif
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    *size = (*size + page - 1) & ~(page - 1);
+    mem = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? (void *)0 : mem;
+}
+
+/**
+ * @brief 释放sys_mem_map映射的内存
+ */
+void sys_mem_unmap(void *mem, size_t size) {
+    munmap(mem, size);
+}
+
 /**
  * 创建线程互斥锁
  * @return 创建的互斥信号量
@@ -609,8 +959,9 @@ int pcap_show_list(void) {
 
 /**
  * 打开pcap设备接口
+ * snaplen为每帧最多捕获的字节数，buffer_size为内核接收缓存的大小，为0时使用pcap的缺省值
  */
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr, int snaplen, int buffer_size) {
     // 加载pcap库
     if (load_pcap_lib() < 0) {
         fprintf(stderr, "load pcap lib error。在windows上，请课程提供的安装npcap.dll\n");
@@ -644,8 +995,14 @@ pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
         return (pcap_t*)0;
     }
 
-    if (pcap_set_snaplen(pcap, 65536) != 0) {
-        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
+    if (pcap_set_snaplen(pcap, snaplen) != 0) {
+        fprintf(stderr, "pcap_open: set snaplen failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    // 缓存过小时，接收线程来不及处理的突发数据帧会被内核丢弃
+    if ((buffer_size > 0) && (pcap_set_buffer_size(pcap, buffer_size) != 0)) {
+        fprintf(stderr, "pcap_open: set buffer size failed: %s\n", pcap_geterr(pcap));
         return (pcap_t*)0;
     }
 
@@ -693,5 +1050,450 @@ pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
     return pcap;
 }
 
+/**
+ * pcap驱动线程的等待器
+ * 驱动线程空闲时在这里睡眠，直到pcap有数据可读或发送方将其唤醒。由于多数平台上
+ * pcap都提供了可等待的句柄，因此与唤醒用的事件一起等待，不需要定时查询。
+ * 每次等待可选择是否等待接收：忙轮询模式下由工作线程接收，只在其退回阻塞等待时才需要
+ */
+#if defined(SYS_PLAT_WINDOWS)
+
+struct _pcap_waiter_t {
+    HANDLE events[2];                   // 唤醒事件、pcap接收事件
+    int cnt;
+};
+
+pcap_waiter_t pcap_waiter_create(pcap_t *pcap, int rx) {
+    pcap_waiter_t waiter = (pcap_waiter_t)malloc(sizeof(struct _pcap_waiter_t));
+    if (waiter == (pcap_waiter_t)0) {
+        return (pcap_waiter_t)0;
+    }
+
+    waiter->events[0] = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (waiter->events[0] == NULL) {
+        free(waiter);
+        return (pcap_waiter_t)0;
+    }
+
+    waiter->cnt = 1;
+    if (rx) {
+        waiter->events[1] = pcap_getevent(pcap);
+        waiter->cnt = 2;
+    }
+    return waiter;
+}
+
+void pcap_waiter_free(pcap_waiter_t waiter) {
+    // pcap的事件由pcap_close释放
+    CloseHandle(waiter->events[0]);
+    free(waiter);
+}
+
+int pcap_waiter_has_rx(pcap_waiter_t waiter) {
+    return waiter->cnt > 1;
+}
+
+/**
+ * @param rx 是否同时等待pcap有数据可读
+ * @return 1 pcap有数据可读，0 被唤醒或超时
+ */
+int pcap_waiter_wait(pcap_waiter_t waiter, int rx, int ms) {
+    DWORD ret = WaitForMultipleObjects(rx ? waiter->cnt : 1, waiter->events, FALSE, ms);
+    return ret == WAIT_OBJECT_0 + 1;
+}
+
+void pcap_waiter_wake(pcap_waiter_t waiter) {
+    SetEvent(waiter->events[0]);
+}
+
+#elif defined(SYS_PLAT_LINUX)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+struct _pcap_waiter_t {
+    int epoll_fd;
+    int event_fd;                       // 用于唤醒的eventfd
+    int rx_fd;                          // pcap的可读描述符，<0表示不可用
+    int rx_added;                       // rx_fd当前是否在epoll中
+};
+
+pcap_waiter_t pcap_waiter_create(pcap_t *pcap, int rx) {
+    pcap_waiter_t waiter = (pcap_waiter_t)malloc(sizeof(struct _pcap_waiter_t));
+    if (waiter == (pcap_waiter_t)0) {
+        return (pcap_waiter_t)0;
+    }
+
+    waiter->epoll_fd = epoll_create1(0);
+    waiter->event_fd = eventfd(0, EFD_NONBLOCK);
+    waiter->rx_fd = -1;
+    waiter->rx_added = 0;
+    if ((waiter->epoll_fd < 0) || (waiter->event_fd < 0)) {
+        goto create_failed;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = waiter->event_fd;
+    if (epoll_ctl(waiter->epoll_fd, EPOLL_CTL_ADD, waiter->event_fd, &ev) < 0) {
+        goto create_failed;
+    }
+
+    if (rx) {
+        // 某些设备不支持select，只能靠超时返回后查询
+        int fd = pcap_get_selectable_fd(pcap);
+        if (fd < 0) {
+            fprintf(stderr, "pcap waiter: no selectable fd, fall back to timed poll\n");
+        } else {
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(waiter->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                goto create_failed;
+            }
+            waiter->rx_fd = fd;
+            waiter->rx_added = 1;
+        }
+    }
+    return waiter;
+
+create_failed:
+    if (waiter->epoll_fd >= 0) {
+        close(waiter->epoll_fd);
+    }
+    if (waiter->event_fd >= 0) {
+        close(waiter->event_fd);
+    }
+    free(waiter);
+    return (pcap_waiter_t)0;
+}
+
+void pcap_waiter_free(pcap_waiter_t waiter) {
+    close(waiter->epoll_fd);
+    close(waiter->event_fd);
+    free(waiter);
+}
+
+int pcap_waiter_has_rx(pcap_waiter_t waiter) {
+    return waiter->rx_fd >= 0;
+}
+
+/**
+ * @param rx 是否同时等待pcap有数据可读。与上次不同时才将其加入或移出epoll
+ * @return 1 pcap有数据可读，0 被唤醒或超时
+ */
+int pcap_waiter_wait(pcap_waiter_t waiter, int rx, int ms) {
+    rx = rx && (waiter->rx_fd >= 0);
+    if (rx != waiter->rx_added) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = waiter->rx_fd;
+        if (epoll_ctl(waiter->epoll_fd, rx ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, waiter->rx_fd, &ev) == 0) {
+            waiter->rx_added = rx;
+        }
+    }
+
+    struct epoll_event evs[2];
+    int ready = 0;
+    int cnt = epoll_wait(waiter->epoll_fd, evs, 2, ms);
+    for (int i = 0; i < cnt; i++) {
+        if (evs[i].data.fd == waiter->event_fd) {
+            // 清除唤醒计数，否则下次会立即返回
+            uint64_t value;
+            if (read(waiter->event_fd, &value, sizeof(value)) < 0) {
+                // 已被清除，忽略
+            }
+        } else if (rx) {
+            ready = 1;
+        }
+    }
+    return ready;
+}
+
+void pcap_waiter_wake(pcap_waiter_t waiter) {
+    uint64_t value = 1;
+    if (write(waiter->event_fd, &value, sizeof(value)) < 0) {
+        // 计数已满时说明已经在唤醒中，忽略
+    }
+}
+
+#else
+#include <poll.h>
+#include <fcntl.h>
+
+struct _pcap_waiter_t {
+    int pipe_fd[2];                     // 用于唤醒的管道
+    int rx_fd;                          // pcap的可读描述符，<0表示不可用
+};
+
+pcap_waiter_t pcap_waiter_create(pcap_t *pcap, int rx) {
+    pcap_waiter_t waiter = (pcap_waiter_t)malloc(sizeof(struct _pcap_waiter_t));
+    if (waiter == (pcap_waiter_t)0) {
+        return (pcap_waiter_t)0;
+    }
+
+    if (pipe(waiter->pipe_fd) < 0) {
+        free(waiter);
+        return (pcap_waiter_t)0;
+    }
+    fcntl(waiter->pipe_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(waiter->pipe_fd[1], F_SETFL, O_NONBLOCK);
+
+    waiter->rx_fd = rx ? pcap_get_selectable_fd(pcap) : -1;
+    return waiter;
+}
+
+void pcap_waiter_free(pcap_waiter_t waiter) {
+    close(waiter->pipe_fd[0]);
+    close(waiter->pipe_fd[1]);
+    free(waiter);
+}
+
+int pcap_waiter_has_rx(pcap_waiter_t waiter) {
+    return waiter->rx_fd >= 0;
+}
+
+/**
+ * @param rx 是否同时等待pcap有数据可读
+ * @return 1 pcap有数据可读，0 被唤醒或超时
+ */
+int pcap_waiter_wait(pcap_waiter_t waiter, int rx, int ms) {
+    struct pollfd fds[2];
+    fds[0].fd = waiter->pipe_fd[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = waiter->rx_fd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    rx = rx && (waiter->rx_fd >= 0);
+    int cnt = poll(fds, rx ? 2 : 1, ms);
+    if ((cnt > 0) && (fds[0].revents & POLLIN)) {
+        char buf[16];
+        while (read(waiter->pipe_fd[0], buf, sizeof(buf)) > 0) {}
+    }
+    return (cnt > 0) && rx && (fds[1].revents & POLLIN);
+}
+
+void pcap_waiter_wake(pcap_waiter_t waiter) {
+    char c = 0;
+    if (write(waiter->pipe_fd[1], &c, 1) < 0) {
+        // 管道已满时说明已经在唤醒中，忽略
+    }
+}
+
+#endif
+
+/**
+ * pcap批量发送队列
+ * 数据帧先加入队列，flush时一次性发送：Npcap上使用pcap_sendqueue，Linux上对pcap的
+ * PF_PACKET套接字使用sendmmsg。其它平台没有批量接口，flush时逐个pcap_inject。
+ * 非Windows平台上队列只记录iovec，数据在flush之前必须保持有效
+ */
+#if defined(SYS_PLAT_WINDOWS)
+
+struct _pcap_sendq_t {
+    pcap_t *pcap;
+    pcap_send_queue *queue;
+    int cnt, max;                       // 已加入和最多可加入的数据帧数量
+    int frame_size;
+    u_char *gather;                     // 拼接多段数据帧的缓存
+};
+
+pcap_sendq_t pcap_sendq_create(pcap_t *pcap, int cnt, int iov_max, int frame_size) {
+    pcap_sendq_t sendq = (pcap_sendq_t)malloc(sizeof(struct _pcap_sendq_t) + frame_size);
+    if (sendq == (pcap_sendq_t)0) {
+        return (pcap_sendq_t)0;
+    }
+
+    sendq->queue = pcap_sendqueue_alloc(cnt * (sizeof(struct pcap_pkthdr) + frame_size));
+    if (sendq->queue == NULL) {
+        free(sendq);
+        return (pcap_sendq_t)0;
+    }
+
+    sendq->pcap = pcap;
+    sendq->cnt = 0;
+    sendq->max = cnt;
+    sendq->frame_size = frame_size;
+    sendq->gather = (u_char *)(sendq + 1);
+    return sendq;
+}
+
+void pcap_sendq_free(pcap_sendq_t sendq) {
+    pcap_sendqueue_destroy(sendq->queue);
+    free(sendq);
+}
+
+int pcap_sendq_add(pcap_sendq_t sendq, const struct iovec *iov, int iov_cnt) {
+    if (sendq->cnt >= sendq->max) {
+        return -1;
+    }
+
+    // pcap_sendqueue_queue会复制数据，只有多段时才需要先拼接
+    struct pcap_pkthdr hdr;
+    const u_char *data = (const u_char *)iov[0].iov_base;
+    int size = 0;
+    if (iov_cnt == 1) {
+        size = (int)iov[0].iov_len;
+    } else {
+        for (int i = 0; i < iov_cnt; i++) {
+            if (size + (int)iov[i].iov_len > sendq->frame_size) {
+                return -1;
+            }
+            memcpy(sendq->gather + size, iov[i].iov_base, iov[i].iov_len);
+            size += (int)iov[i].iov_len;
+        }
+        data = sendq->gather;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.caplen = hdr.len = size;
+    if (pcap_sendqueue_queue(sendq->queue, &hdr, data) < 0) {
+        return -1;
+    }
+    return sendq->cnt++;
+}
+
+int pcap_sendq_flush(pcap_sendq_t sendq) {
+    int cnt = sendq->cnt;
+    if (cnt == 0) {
+        return 0;
+    }
+
+    u_int len = sendq->queue->len;
+    if (pcap_sendqueue_transmit(sendq->pcap, sendq->queue, 0) < len) {
+        fprintf(stderr, "pcap sendqueue failed: %s\n", pcap_geterr(sendq->pcap));
+    }
+
+    sendq->queue->len = 0;
+    sendq->cnt = 0;
+    return cnt;
+}
+
+#else
+
+#if defined(SYS_PLAT_LINUX)
+#include <sys/socket.h>
+#endif
+
+struct _pcap_sendq_t {
+    pcap_t *pcap;
+    int cnt, max;                       // 已加入和最多可加入的数据帧数量
+    int iov_max;                        // 每个数据帧最多的分段数
+    int frame_size;
+    struct iovec *iov;                  // 各数据帧的分段，每帧iov_max个
+#if defined(SYS_PLAT_LINUX)
+    struct mmsghdr *msgs;
+#else
+    int *iov_cnt;                       // 各数据帧的分段数
+    u_char *gather;                     // 拼接多段数据帧的缓存
+#endif
+};
+
+pcap_sendq_t pcap_sendq_create(pcap_t *pcap, int cnt, int iov_max, int frame_size) {
+    pcap_sendq_t sendq = (pcap_sendq_t)calloc(1, sizeof(struct _pcap_sendq_t));
+    if (sendq == (pcap_sendq_t)0) {
+        return (pcap_sendq_t)0;
+    }
+
+    sendq->pcap = pcap;
+    sendq->max = cnt;
+    sendq->iov_max = iov_max;
+    sendq->frame_size = frame_size;
+    sendq->iov = (struct iovec *)malloc(sizeof(struct iovec) * cnt * iov_max);
+#if defined(SYS_PLAT_LINUX)
+    sendq->msgs = (struct mmsghdr *)calloc(cnt, sizeof(struct mmsghdr));
+    if (!sendq->iov || !sendq->msgs) {
+        pcap_sendq_free(sendq);
+        return (pcap_sendq_t)0;
+    }
+#else
+    sendq->iov_cnt = (int *)malloc(sizeof(int) * cnt);
+    sendq->gather = (u_char *)malloc(frame_size);
+    if (!sendq->iov || !sendq->iov_cnt || !sendq->gather) {
+        pcap_sendq_free(sendq);
+        return (pcap_sendq_t)0;
+    }
+#endif
+    return sendq;
+}
+
+void pcap_sendq_free(pcap_sendq_t sendq) {
+    free(sendq->iov);
+#if defined(SYS_PLAT_LINUX)
+    free(sendq->msgs);
+#else
+    free(sendq->iov_cnt);
+    free(sendq->gather);
+#endif
+    free(sendq);
+}
+
+int pcap_sendq_add(pcap_sendq_t sendq, const struct iovec *iov, int iov_cnt) {
+    if ((sendq->cnt >= sendq->max) || (iov_cnt > sendq->iov_max)) {
+        return -1;
+    }
+
+    struct iovec *dest = sendq->iov + sendq->cnt * sendq->iov_max;
+    memcpy(dest, iov, sizeof(struct iovec) * iov_cnt);
+#if defined(SYS_PLAT_LINUX)
+    struct msghdr *hdr = &sendq->msgs[sendq->cnt].msg_hdr;
+    memset(hdr, 0, sizeof(struct msghdr));
+    hdr->msg_iov = dest;
+    hdr->msg_iovlen = iov_cnt;
+#else
+    sendq->iov_cnt[sendq->cnt] = iov_cnt;
+#endif
+    return sendq->cnt++;
+}
+
+int pcap_sendq_flush(pcap_sendq_t sendq) {
+    int cnt = sendq->cnt;
+    if (cnt == 0) {
+        return 0;
+    }
+
+#if defined(SYS_PLAT_LINUX)
+    // pcap在Linux上使用PF_PACKET套接字，pcap_inject也是直接send，因此可以对其sendmmsg
+    int fd = pcap_fileno(sendq->pcap);
+    int sent = 0;
+    while (sent < cnt) {
+        int n = sendmmsg(fd, sendq->msgs + sent, cnt - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // 发送失败的帧跳过，继续发送后面的
+            fprintf(stderr, "pcap sendmmsg failed: %s\n", strerror(errno));
+            n = 1;
+        }
+        sent += n;
+    }
+#else
+    for (int i = 0; i < cnt; i++) {
+        struct iovec *iov = sendq->iov + i * sendq->iov_max;
+        const u_char *data = (const u_char *)iov[0].iov_base;
+        int size = 0;
+        if (sendq->iov_cnt[i] == 1) {
+            size = (int)iov[0].iov_len;
+        } else {
+            for (int k = 0; k < sendq->iov_cnt[i]; k++) {
+                memcpy(sendq->gather + size, iov[k].iov_base, iov[k].iov_len);
+                size += (int)iov[k].iov_len;
+            }
+            data = sendq->gather;
+        }
+
+        if (pcap_inject(sendq->pcap, data, size) == -1) {
+            fprintf(stderr, "pcap send failed: %s\n", pcap_geterr(sendq->pcap));
+        }
+    }
+#endif
+
+    sendq->cnt = 0;
+    return cnt;
+}
+
+#endif
+
 // #endif
 
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <time.h>
 
 // 系统硬件配置
@@ -56,6 +57,12 @@ typedef mutex_t * sys_mutex_t;        // 互斥锁
 typedef task_t * sys_thread_t;        // 线程
 typedef sem_t * sys_sem_t;            // 信号量
 
+// 分散/聚集IO的数据段，与POSIX的struct iovec兼容
+struct iovec {
+    void *iov_base;                     // 数据段起始地址
+    size_t iov_len;                     // 数据段长度
+};
+
 #define plat_strlen         kernel_strlen
 #define plat_strcpy         kernel_strcpy
 #define plat_strncpy        kernel_strncpy
@@ -87,6 +94,12 @@ typedef HANDLE sys_mutex_t;         // 互斥锁
 typedef HANDLE sys_thread_t;        // 线程
 typedef HANDLE sys_sem_t;           // 信号量
 
+// 分散/聚集IO的数据段，与POSIX的struct iovec兼容
+struct iovec {
+    void *iov_base;                     // 数据段起始地址
+    size_t iov_len;                     // 数据段长度
+};
+
 #define plat_strlen         strlen
 #define plat_strcpy         strcpy
 #define plat_strncpy        strncpy
@@ -102,7 +115,22 @@ typedef HANDLE sys_sem_t;           // 信号量
 // PCAP网卡驱动相关函数
 int pcap_find_device(const char* ip, char* name_buf);
 int pcap_show_list(void);
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr, int snaplen, int buffer_size);
+
+// pcap驱动线程的等待器：被唤醒，或等待接收时pcap有数据可读时返回
+typedef struct _pcap_waiter_t * pcap_waiter_t;
+pcap_waiter_t pcap_waiter_create(pcap_t *pcap, int rx);
+void pcap_waiter_free(pcap_waiter_t waiter);
+int pcap_waiter_has_rx(pcap_waiter_t waiter);
+int pcap_waiter_wait(pcap_waiter_t waiter, int rx, int ms);
+void pcap_waiter_wake(pcap_waiter_t waiter);
+
+// pcap批量发送队列：多个数据帧只用一次系统调用发送
+typedef struct _pcap_sendq_t * pcap_sendq_t;
+pcap_sendq_t pcap_sendq_create(pcap_t *pcap, int cnt, int iov_max, int frame_size);
+void pcap_sendq_free(pcap_sendq_t sendq);
+int pcap_sendq_add(pcap_sendq_t sendq, const struct iovec *iov, int iov_cnt);
+int pcap_sendq_flush(pcap_sendq_t sendq);
 
 #elif defined(SYS_PLAT_LINUX) || defined(SYS_PLAT_MAC)
 
@@ -110,6 +138,7 @@ pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <pcap.h>
 #include <string.h>
@@ -133,11 +162,21 @@ typedef struct timeval net_time_t;      // 时间类型
 #define plat_vsprintf       vsprintf
 #define plat_printf         printf
 
+#if defined(__linux__)
+// Linux上使用futex实现信号量：计数够用时只有原子操作，需要等待/唤醒时才进入内核
+#define SYS_SEM_FUTEX       1
+
+typedef struct _xsys_sem_t {
+    int count;                          // 信号量计数，也是futex等待的地址
+    int waiters;                        // 正在等待的线程数量，为0时通知无需进入内核
+} * sys_sem_t;
+#else
 typedef struct _xsys_sem_t {
     int count;                          // 信号量计数
     pthread_cond_t cond;                // 条件变量
     pthread_mutex_t locker;             // 访问C的互斥锁
 } * sys_sem_t;
+#endif
 
 typedef pthread_t sys_thread_t;           // 线程重定义
 typedef pthread_mutex_t * sys_mutex_t;      // 互斥信号量
@@ -145,16 +184,68 @@ typedef pthread_mutex_t * sys_mutex_t;      // 互斥信号量
 // PCAP网卡驱动相关函数
 int pcap_find_device(const char* ip, char* name_buf);
 int pcap_show_list(void);
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr, int snaplen, int buffer_size);
+
+// pcap驱动线程的等待器：被唤醒，或等待接收时pcap有数据可读时返回
+typedef struct _pcap_waiter_t * pcap_waiter_t;
+pcap_waiter_t pcap_waiter_create(pcap_t *pcap, int rx);
+void pcap_waiter_free(pcap_waiter_t waiter);
+int pcap_waiter_has_rx(pcap_waiter_t waiter);
+int pcap_waiter_wait(pcap_waiter_t waiter, int rx, int ms);
+void pcap_waiter_wake(pcap_waiter_t waiter);
+
+// pcap批量发送队列：多个数据帧只用一次系统调用发送
+typedef struct _pcap_sendq_t * pcap_sendq_t;
+pcap_sendq_t pcap_sendq_create(pcap_t *pcap, int cnt, int iov_max, int frame_size);
+void pcap_sendq_free(pcap_sendq_t sendq);
+int pcap_sendq_add(pcap_sendq_t sendq, const struct iovec *iov, int iov_cnt);
+int pcap_sendq_flush(pcap_sendq_t sendq);
 
 #else
     #error "Unkonw platform"
 #endif // Unix/Linux
 
+// 线程局部存储与原子操作：各平台均使用GCC兼容的编译器（Windows上为MinGW）
+#if defined(__GNUC__)
+#define SYS_THREAD_LOCAL                __thread
+#elif defined(_MSC_VER)
+#define SYS_THREAD_LOCAL                __declspec(thread)
+#endif
+
+#define sys_atomic_inc(ptr)             __atomic_add_fetch((ptr), 1, __ATOMIC_ACQ_REL)
+#define sys_atomic_dec(ptr)             __atomic_sub_fetch((ptr), 1, __ATOMIC_ACQ_REL)
+#define sys_atomic_load(ptr)            __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define sys_atomic_store(ptr, v)        __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+#define sys_atomic_xchg(ptr, v)         __atomic_exchange_n((ptr), (v), __ATOMIC_ACQ_REL)
+#define sys_atomic_fence()              __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+// 自旋等待时降低cpu占用、让出超线程资源
+#if defined(__i386__) || defined(__x86_64__)
+#define sys_cpu_relax()                 __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define sys_cpu_relax()                 __asm__ __volatile__("yield" ::: "memory")
+#else
+#define sys_cpu_relax()                 do {} while (0)
+#endif
+
+#define SYS_HUGE_PAGE_SIZE              (2 * 1024 * 1024)   // 大页大小
+
+// 缓存行大小，被不同线程频繁修改的字段应放在不同的缓存行中，避免伪共享
+#define SYS_CACHE_LINE_SIZE             64
+#if defined(__GNUC__)
+#define SYS_CACHE_ALIGNED               __attribute__((aligned(SYS_CACHE_LINE_SIZE)))
+#elif defined(_MSC_VER)
+#define SYS_CACHE_ALIGNED               __declspec(align(SYS_CACHE_LINE_SIZE))
+#endif
+#define SYS_CACHE_ROUNDUP(size)         (((size) + SYS_CACHE_LINE_SIZE - 1) & ~(SYS_CACHE_LINE_SIZE - 1)) // 按缓存行大小向上取整
+#define SYS_CACHE_LINE_OF(type, member) (offsetof(type, member) / SYS_CACHE_LINE_SIZE)    // 成员所在的缓存行
+
 sys_sem_t sys_sem_create(int init_count);
 void sys_sem_free(sys_sem_t sem);
 int sys_sem_wait(sys_sem_t sem, uint32_t ms);
 void sys_sem_notify(sys_sem_t sem);
+int sys_sem_try_wait_n(sys_sem_t sem, int n);
+void sys_sem_notify_n(sys_sem_t sem, int n);
 
 // 互斥信号量：由具体平台实现
 sys_mutex_t sys_mutex_create(void);
@@ -168,6 +259,16 @@ typedef void (*sys_thread_func_t)(void * arg);
 sys_thread_t sys_thread_create(sys_thread_func_t entry, void* arg);
 void sys_thread_exit (int error);
 void sys_sleep(int ms);
+void sys_thread_yield(void);
+int sys_thread_bind_cpu(sys_thread_t thread, int cpu);
+
+// 时间相关：由具体平台实现
+void sys_time_curr (net_time_t * time);
+int sys_time_goes (net_time_t * pre);
+
+// 内存映射：用于数据包池等大块内存，由具体平台实现
+void *sys_mem_map(size_t *size);
+void sys_mem_unmap(void *mem, size_t size);
 sys_thread_t sys_thread_self (void);
 
 void sys_plat_init(void);
@@ -0,0 +1,96 @@
+/**
+ * @file layout_report.c
+ * @brief 热点结构体的内存布局报告
+ *        按pahole的格式输出fixq_t、mblock_t、pktbuf_t和pktblk_t中各字段的偏移、大小、
+ *        所在的缓存行以及字段之间的空洞，用于检查修改结构体后是否出现伪共享
+ *
+ *        编译：cmake --build build --target layout_report
+ */
+#include <stdio.h>
+#include "fixq.h"
+#include "mblock.h"
+#include "pktbuf.h"
+
+static size_t field_end;            // 上一个字段的结束位置，用于计算空洞
+
+static void report_begin(const char *name) {
+    printf("struct %s {\n", name);
+    field_end = 0;
+}
+
+static void report_field(const char *name, size_t offset, size_t size) {
+    if (offset > field_end) {
+        printf("    /* XXX %d bytes hole */\n", (int)(offset - field_end));
+    }
+    if ((offset % SYS_CACHE_LINE_SIZE == 0) && offset) {
+        printf("    /* --- cacheline %d boundary (%d bytes) --- */\n",
+            (int)(offset / SYS_CACHE_LINE_SIZE), (int)offset);
+    }
+    printf("    %-16s /* %5d %5d */\n", name, (int)offset, (int)size);
+    field_end = offset + size;
+}
+
+static void report_end(size_t size) {
+    if (size > field_end) {
+        printf("    /* XXX %d bytes padding */\n", (int)(size - field_end));
+    }
+    printf("    /* size: %d, cachelines: %d */\n};\n\n",
+        (int)size, (int)((size + SYS_CACHE_LINE_SIZE - 1) / SYS_CACHE_LINE_SIZE));
+}
+
+#define REPORT_FIELD(type, member)  \
+    report_field(#member, offsetof(type, member), sizeof(((type *)0)->member))
+
+int main(void) {
+    report_begin("fixq_t");
+    REPORT_FIELD(fixq_t, size);
+    REPORT_FIELD(fixq_t, spsc);
+    REPORT_FIELD(fixq_t, buf);
+    REPORT_FIELD(fixq_t, recv_sem);
+    REPORT_FIELD(fixq_t, send_sem);
+    REPORT_FIELD(fixq_t, locker);
+    REPORT_FIELD(fixq_t, cnt);
+    REPORT_FIELD(fixq_t, in);
+    REPORT_FIELD(fixq_t, prod);
+    REPORT_FIELD(fixq_t, prod_wait);
+    REPORT_FIELD(fixq_t, out);
+    REPORT_FIELD(fixq_t, cons);
+    REPORT_FIELD(fixq_t, cons_wait);
+    report_end(sizeof(fixq_t));
+
+    report_begin("mblock_t");
+    REPORT_FIELD(mblock_t, start);
+    REPORT_FIELD(mblock_t, blk_size);
+    REPORT_FIELD(mblock_t, blk_cnt);
+    REPORT_FIELD(mblock_t, alloc_sem);
+    REPORT_FIELD(mblock_t, locker);
+    REPORT_FIELD(mblock_t, free_list);
+    REPORT_FIELD(mblock_t, lf_top);
+    REPORT_FIELD(mblock_t, lf_waiters);
+    report_end(sizeof(mblock_t));
+
+    report_begin("pktbuf_t");
+    REPORT_FIELD(pktbuf_t, blk_list);
+    REPORT_FIELD(pktbuf_t, total_size);
+    REPORT_FIELD(pktbuf_t, ref);
+    REPORT_FIELD(pktbuf_t, node);
+    REPORT_FIELD(pktbuf_t, pos);
+    REPORT_FIELD(pktbuf_t, curr_blk);
+    REPORT_FIELD(pktbuf_t, blk_offset);
+    report_end(sizeof(pktbuf_t));
+
+    report_begin("pktblk_t");
+    REPORT_FIELD(pktblk_t, node);
+    REPORT_FIELD(pktblk_t, data);
+    REPORT_FIELD(pktblk_t, size);
+    REPORT_FIELD(pktblk_t, capacity);
+    REPORT_FIELD(pktblk_t, base);
+    REPORT_FIELD(pktblk_t, ref);
+    REPORT_FIELD(pktblk_t, pool);
+    REPORT_FIELD(pktblk_t, owner);
+    REPORT_FIELD(pktblk_t, release);
+    REPORT_FIELD(pktblk_t, release_arg);
+    report_field("payload", offsetof(pktblk_t, payload), 0);
+    report_end(sizeof(pktblk_t));
+    return 0;
+}